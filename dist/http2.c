@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "qingstor/qingstor.h"
+
+/*
+ * Compare chunked downloads over HTTP/1.1 and HTTP/2.
+ *
+ * usage: http2 <http1 config> <http2 config> <bucket> <key>
+ *
+ * Both configuration files point at the same endpoint; the second one sets
+ * "enable_http2: true". To run against a local h2 test server, put a TLS
+ * frontend such as nghttpx on port 443 in front of a QingStor compatible
+ * backend, and resolve <bucket>.<location>.<host> to it:
+ *
+ *   nghttpx -f'0.0.0.0,443' -b'127.0.0.1,8080' server.key server.crt
+ *
+ * Use a small chunk_size and a num_connections above 1 in both files so the
+ * object is fetched as many concurrent ranges.
+ */
+
+int64_t getcurrenttime()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static double CalculateThroughput(int64_t elapsed, int64_t size)
+{
+    return size / 1024.0 * 1000.0 / 1024.0 / elapsed;
+}
+
+const int read_buffer_size = 8 << 20;
+int64_t iterations = 8;
+
+int64_t testGetObject(const char *config, const char *bucket, const char *key)
+{
+	int64_t total = 0;
+	int i;
+	qingstorContext qsContext = qingstorInitContextFromFile(config);
+	if (!qsContext)
+	{
+		printf("qingstor init context failed with error message: %s\n", qingstorGetLastError());
+		return -1;
+	}
+
+	char *buffer = (char *)malloc(read_buffer_size * sizeof(char));
+	for (i = 0; i < iterations; i++)
+	{
+		qingstorObject object = qingstorGetObject(qsContext, bucket, key, -1, -1);
+		if (!object)
+		{
+			printf("qingstor get object failed with error message: %s\n", qingstorGetLastError());
+			total = -1;
+			break;
+		}
+		int32_t read_bytes = 0;
+		do
+		{
+			read_bytes = qingstorRead(qsContext, object, buffer, read_buffer_size);
+			if (read_bytes > 0)
+			{
+				total += read_bytes;
+			}
+		}
+		while (read_bytes > 0);
+		qingstorCloseObject(qsContext, object);
+		if (read_bytes < 0)
+		{
+			printf("qingstor read failed with error message: %s\n", qingstorGetLastError());
+			total = -1;
+			break;
+		}
+	}
+	free(buffer);
+
+	qingstorConnectionPoolStats stats;
+	if (qingstorGetConnectionPoolStats(qsContext, &stats) == 0)
+	{
+		printf("connection pool: %ld hits, %ld misses\n", stats.hits, stats.misses);
+	}
+	qingstorDestroyContext(qsContext);
+	return total;
+}
+
+void runBenchmark(const char *name, const char *config, const char *bucket, const char *key)
+{
+	int64_t start, stop, size;
+	start = getcurrenttime();
+	size = testGetObject(config, bucket, key);
+	stop = getcurrenttime();
+	if (size < 0)
+	{
+		printf("%s: failed\n", name);
+		return;
+	}
+	printf("%s: %ld bytes in %ld ms, throughput is %lf mbytes/s\n", name, size, stop - start,
+			CalculateThroughput(stop - start > 0 ? stop - start : 1, size));
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 5)
+	{
+		printf("usage: %s <http1 config> <http2 config> <bucket> <key>\n", argv[0]);
+		return 1;
+	}
+	runBenchmark("HTTP/1.1", argv[1], argv[3], argv[4]);
+	runBenchmark("HTTP/2", argv[2], argv[3], argv[4]);
+	return 0;
+}
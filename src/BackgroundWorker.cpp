@@ -0,0 +1,111 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BackgroundWorker.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+#include "Logger.h"
+
+namespace QingStor {
+namespace Internal {
+
+BackgroundWorker::BackgroundWorker(int nthreads)
+								: mNThreads(nthreads),
+								  mStop(false)
+{
+}
+
+BackgroundWorker::~BackgroundWorker()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStop = true;
+		mTasks.clear();
+	}
+	mCond.notify_all();
+
+	for (size_t i = 0; i < mThreads.size(); i++)
+	{
+		mThreads[i]->join();
+	}
+}
+
+bool BackgroundWorker::submit(function<void(void)> task)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		if (mStop)
+		{
+			return false;
+		}
+
+		while (static_cast<int>(mThreads.size()) < mNThreads)
+		{
+			shared_ptr<thread> t = shared_ptr<thread> (new thread);
+			CREATE_THREAD(*t, bind(&BackgroundWorker::run, this));
+			mThreads.push_back(t);
+		}
+
+		mTasks.push_back(task);
+	}
+	mCond.notify_one();
+	return true;
+}
+
+bool BackgroundWorker::stopping()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mStop;
+}
+
+void BackgroundWorker::run()
+{
+	while (true)
+	{
+		function<void(void)> task;
+
+		{
+			unique_lock<mutex> lock(mMutex);
+			while (!mStop && mTasks.empty())
+			{
+				mCond.wait(lock);
+			}
+			if (mStop)
+			{
+				return;
+			}
+			task = mTasks.front();
+			mTasks.pop_front();
+		}
+
+		/* nobody waits for the result, a failed task is only logged */
+		try {
+			task();
+		} catch (const std::exception & e)
+		{
+			LOG(WARNING, "background task failed: %s", e.what());
+		}
+	}
+}
+
+}
+}
@@ -0,0 +1,80 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_BACKGROUNDWORKER_H_
+#define __QINGSTOR_LIBQINGSTOR_BACKGROUNDWORKER_H_
+
+#include "Function.h"
+#include "Memory.h"
+#include "Thread.h"
+
+#include <deque>
+#include <vector>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * A few threads of a Context that run tasks in the background, e.g. opening
+ * connections ahead of time.
+ *
+ * The threads are started by the first submit(). When the worker is destroyed,
+ * the task being run is waited for, and tasks not started yet are dropped. A
+ * long task should poll stopping() and return early.
+ */
+class BackgroundWorker {
+public:
+	BackgroundWorker(int nthreads);
+
+	~BackgroundWorker();
+
+	/*
+	 * Queue a task, it is run by the first idle thread. Return false, and
+	 * drop the task, once the worker is stopping. Throws if the threads could
+	 * not be started, the task is not queued then either.
+	 */
+	bool submit(function<void(void)> task);
+
+	/*
+	 * True once the worker is being destroyed.
+	 */
+	bool stopping();
+
+private:
+	mutex mMutex;
+	condition_variable mCond;
+
+	std::deque<function<void(void)> > mTasks;
+	std::vector<shared_ptr<thread> > mThreads;
+	int mNThreads;
+	bool mStop;
+
+	/*
+	 * Main loop of a worker thread.
+	 */
+	void run();
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_BACKGROUNDWORKER_H_ */
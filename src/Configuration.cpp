@@ -26,6 +26,7 @@
 #include "ExceptionInternal.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <yaml.h>
 
 #include <map>
@@ -53,6 +54,34 @@ static const char *CONFIG_KEY_CHUNK_SIZE = "chunk_size";
 
 static const char *CONFIG_KEY_LOG_LEVEL = "log_level";
 
+static const char *CONFIG_KEY_MAX_IDLE_CONNECTIONS = "max_idle_connections";
+
+static const char *CONFIG_KEY_ENABLE_HTTP2 = "enable_http2";
+
+static const char *CONFIG_KEY_UPLOAD_CONCURRENCY = "upload_concurrency";
+
+static const char *CONFIG_KEY_MAX_TRANSFERS_PER_HOST = "max_transfers_per_host";
+
+static const char *CONFIG_KEY_PREWARM_CONNECTIONS = "prewarm_connections";
+
+static const char *CONFIG_KEY_PREWARM_BUCKET = "prewarm_bucket";
+
+static const char *CONFIG_KEY_PART_BUFFER_LIMIT = "part_buffer_limit";
+
+static const char *CONFIG_KEY_PART_BUFFER_WAIT = "part_buffer_wait";
+
+static const char *CONFIG_KEY_ENABLE_CONTENT_MD5 = "enable_content_md5";
+
+static const char *CONFIG_KEY_SPOOL_DIR = "spool_dir";
+
+static const char *CONFIG_KEY_SPOOL_LIMIT = "spool_limit";
+
+static const char *CONFIG_KEY_STREAM_BUFFER_SIZE = "stream_buffer_size";
+
+static const char *CONFIG_KEY_CLOSE_CONCURRENCY = "close_concurrency";
+
+static const char *CONFIG_KEY_READV_GAP = "readv_gap";
+
 Configuration::Configuration(std::string location, std::string access_key_id, std::string secret_access_key, int64_t chunk_size)
 {
 	mAccessKeyId = access_key_id;
@@ -66,6 +95,18 @@ Configuration::Configuration(std::string location, std::string access_key_id, st
 	mConnectionRetries = 3;
 	mNConnections = 3;
 	mLogLevel = "debug";
+	mMaxIdleConnections = 8;
+	mEnableHttp2 = false;
+	mUploadConcurrency = 1;
+	mMaxTransfersPerHost = 64;
+	mPrewarmConnections = 0;
+	mPartBufferLimit = 0;
+	mPartBufferWait = -1;
+	mEnableContentMD5 = false;
+	mSpoolLimit = 0;
+	mStreamBufferSize = 0;
+	mCloseConcurrency = 8;
+	mReadvGap = 1024 * 1024;
 }
 
 Configuration::Configuration(std::string config_file)
@@ -122,8 +163,10 @@ Configuration::Configuration(std::string config_file)
 				bool config_invalid = false;
 				if (reach_key)
 				{
+					/* wait for the value before recording the pair */
 					token_key = std::string((const char*)(token.data.scalar.value));
 					reach_key = false;
+					break;
 				}
 				else if (reach_value)
 				{
@@ -292,6 +335,212 @@ Configuration::Configuration(std::string config_file)
 	{
 		mLogLevel = kvs[std::string(CONFIG_KEY_LOG_LEVEL)];
 	}
+
+	if (kvs[std::string(CONFIG_KEY_MAX_IDLE_CONNECTIONS)].empty())
+	{
+		mMaxIdleConnections = 8;
+	}
+	else
+	{
+		std::string max_idle_str = kvs[std::string(CONFIG_KEY_MAX_IDLE_CONNECTIONS)];
+		int num = atoi(max_idle_str.c_str());
+		if (num < 0 || num > 64)
+		{
+			LOG(WARNING, "Configuration max idle connections %s is invalid, using default 8", max_idle_str.c_str());
+			num = 8;
+		}
+		mMaxIdleConnections = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_ENABLE_HTTP2)].empty())
+	{
+		mEnableHttp2 = false;
+	}
+	else
+	{
+		std::string http2_str = kvs[std::string(CONFIG_KEY_ENABLE_HTTP2)];
+		if (http2_str == "true" || http2_str == "on" || http2_str == "1")
+		{
+			mEnableHttp2 = true;
+		}
+		else
+		{
+			if (http2_str != "false" && http2_str != "off" && http2_str != "0")
+			{
+				LOG(WARNING, "Configuration enable http2 %s is invalid, using default false", http2_str.c_str());
+			}
+			mEnableHttp2 = false;
+		}
+	}
+
+	if (kvs[std::string(CONFIG_KEY_UPLOAD_CONCURRENCY)].empty())
+	{
+		mUploadConcurrency = 1;
+	}
+	else
+	{
+		std::string concurrency_str = kvs[std::string(CONFIG_KEY_UPLOAD_CONCURRENCY)];
+		int num = atoi(concurrency_str.c_str());
+		if (num <= 0 || num > 64)
+		{
+			LOG(WARNING, "Configuration upload concurrency %s is invalid, using default 1", concurrency_str.c_str());
+			num = 1;
+		}
+		mUploadConcurrency = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_MAX_TRANSFERS_PER_HOST)].empty())
+	{
+		mMaxTransfersPerHost = 64;
+	}
+	else
+	{
+		std::string max_transfers_str = kvs[std::string(CONFIG_KEY_MAX_TRANSFERS_PER_HOST)];
+		int num = atoi(max_transfers_str.c_str());
+		if (num < 0 || num > 1024)
+		{
+			LOG(WARNING, "Configuration max transfers per host %s is invalid, using default 64", max_transfers_str.c_str());
+			num = 64;
+		}
+		mMaxTransfersPerHost = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_PREWARM_CONNECTIONS)].empty())
+	{
+		mPrewarmConnections = 0;
+	}
+	else
+	{
+		std::string prewarm_str = kvs[std::string(CONFIG_KEY_PREWARM_CONNECTIONS)];
+		int num = atoi(prewarm_str.c_str());
+		if (num < 0 || num > 64)
+		{
+			LOG(WARNING, "Configuration prewarm connections %s is invalid, using default 0", prewarm_str.c_str());
+			num = 0;
+		}
+		mPrewarmConnections = num;
+	}
+
+	mPrewarmBucket = kvs[std::string(CONFIG_KEY_PREWARM_BUCKET)];
+
+	if (kvs[std::string(CONFIG_KEY_PART_BUFFER_LIMIT)].empty())
+	{
+		mPartBufferLimit = 0;
+	}
+	else
+	{
+		std::string limit_str = kvs[std::string(CONFIG_KEY_PART_BUFFER_LIMIT)];
+		int64_t num = atoll(limit_str.c_str());
+		if (num < 0)
+		{
+			LOG(WARNING, "Configuration part buffer limit %s is invalid, using default 0", limit_str.c_str());
+			num = 0;
+		}
+		mPartBufferLimit = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_PART_BUFFER_WAIT)].empty())
+	{
+		mPartBufferWait = -1;
+	}
+	else
+	{
+		std::string wait_str = kvs[std::string(CONFIG_KEY_PART_BUFFER_WAIT)];
+		int num = atoi(wait_str.c_str());
+		if (num < -1)
+		{
+			LOG(WARNING, "Configuration part buffer wait %s is invalid, using default -1", wait_str.c_str());
+			num = -1;
+		}
+		mPartBufferWait = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_ENABLE_CONTENT_MD5)].empty())
+	{
+		mEnableContentMD5 = false;
+	}
+	else
+	{
+		std::string md5_str = kvs[std::string(CONFIG_KEY_ENABLE_CONTENT_MD5)];
+		if (md5_str == "true" || md5_str == "on" || md5_str == "1")
+		{
+			mEnableContentMD5 = true;
+		}
+		else
+		{
+			if (md5_str != "false" && md5_str != "off" && md5_str != "0")
+			{
+				LOG(WARNING, "Configuration enable content md5 %s is invalid, using default false", md5_str.c_str());
+			}
+			mEnableContentMD5 = false;
+		}
+	}
+
+	mSpoolDir = kvs[std::string(CONFIG_KEY_SPOOL_DIR)];
+
+	if (kvs[std::string(CONFIG_KEY_SPOOL_LIMIT)].empty())
+	{
+		mSpoolLimit = 0;
+	}
+	else
+	{
+		std::string limit_str = kvs[std::string(CONFIG_KEY_SPOOL_LIMIT)];
+		int64_t num = atoll(limit_str.c_str());
+		if (num < 0)
+		{
+			LOG(WARNING, "Configuration spool limit %s is invalid, using default 0", limit_str.c_str());
+			num = 0;
+		}
+		mSpoolLimit = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_STREAM_BUFFER_SIZE)].empty())
+	{
+		mStreamBufferSize = 0;
+	}
+	else
+	{
+		std::string stream_str = kvs[std::string(CONFIG_KEY_STREAM_BUFFER_SIZE)];
+		int64_t num = atoll(stream_str.c_str());
+		if (num < 0)
+		{
+			LOG(WARNING, "Configuration stream buffer size %s is invalid, using default 0", stream_str.c_str());
+			num = 0;
+		}
+		mStreamBufferSize = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_CLOSE_CONCURRENCY)].empty())
+	{
+		mCloseConcurrency = 8;
+	}
+	else
+	{
+		std::string close_str = kvs[std::string(CONFIG_KEY_CLOSE_CONCURRENCY)];
+		int num = atoi(close_str.c_str());
+		if (num <= 0 || num > 256)
+		{
+			LOG(WARNING, "Configuration close concurrency %s is invalid, using default 8", close_str.c_str());
+			num = 8;
+		}
+		mCloseConcurrency = num;
+	}
+
+	if (kvs[std::string(CONFIG_KEY_READV_GAP)].empty())
+	{
+		mReadvGap = 1024 * 1024;
+	}
+	else
+	{
+		std::string gap_str = kvs[std::string(CONFIG_KEY_READV_GAP)];
+		int64_t num = atoll(gap_str.c_str());
+		if (num < 0)
+		{
+			LOG(WARNING, "Configuration readv gap %s is invalid, using default 1048576", gap_str.c_str());
+			num = 1024 * 1024;
+		}
+		mReadvGap = num;
+	}
 }
 
 }
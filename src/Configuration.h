@@ -44,6 +44,20 @@ public:
 	int mNConnections;
 	int64_t mChunkSize;
 	std::string mLogLevel;
+	int mMaxIdleConnections;		/* idle keep-alive handles kept per host */
+	bool mEnableHttp2;				/* negotiate HTTP/2 and multiplex transfers to a host */
+	int mUploadConcurrency;			/* parts of a writer uploaded at the same time */
+	int mMaxTransfersPerHost;		/* transfers in flight to a host over all the handles, 0 is no cap */
+	int mPrewarmConnections;		/* connections opened ahead of the first request */
+	std::string mPrewarmBucket;		/* bucket prewarmed when the context is created */
+	int64_t mPartBufferLimit;		/* bytes of part buffers over all the writers, 0 is no cap */
+	int mPartBufferWait;			/* ms a writer waits for part buffer memory, -1 is forever */
+	bool mEnableContentMD5;			/* send Content-MD5 with the parts and check their ETags */
+	std::string mSpoolDir;			/* where spooled writers stage their objects, empty is none */
+	int64_t mSpoolLimit;			/* bytes staged in the spool before writers wait, 0 is no cap */
+	int64_t mStreamBufferSize;		/* ring a part is streamed through as it is written, 0 buffers whole parts */
+	int mCloseConcurrency;			/* writers closed in the background at the same time */
+	int64_t mReadvGap;				/* ranges of a vectored read closer than this go in one GET */
 };
 
 }
@@ -0,0 +1,207 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ConnectionPool.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+#include "Logger.h"
+
+namespace QingStor {
+namespace Internal {
+
+ConnectionPool::ConnectionPool(int maxIdlePerHost, bool http2)
+							: mMaxIdlePerHost(maxIdlePerHost),
+							  mHttp2(http2),
+							  mNIdle(0),
+							  mHits(0),
+							  mMisses(0),
+							  mDiscards(0)
+{
+	mShare = curl_share_init();
+	if (!mShare)
+	{
+		THROW(OutOfMemoryException, "could not create curl share handle");
+	}
+	curl_share_setopt(mShare, CURLSHOPT_LOCKFUNC, ConnectionPool::ShareLock);
+	curl_share_setopt(mShare, CURLSHOPT_UNLOCKFUNC, ConnectionPool::ShareUnlock);
+	curl_share_setopt(mShare, CURLSHOPT_USERDATA, (void *)this);
+	curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(mShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	std::map<std::string, std::list<CURL *> >::iterator itr = mIdleHandles.begin();
+	while (itr != mIdleHandles.end())
+	{
+		std::list<CURL *>::iterator citr = itr->second.begin();
+		while (citr != itr->second.end())
+		{
+			curl_easy_cleanup(*citr);
+			citr++;
+		}
+		itr++;
+	}
+	mIdleHandles.clear();
+
+	/* handles still borrowed at this point keep the share busy, it is leaked then */
+	if (curl_share_cleanup(mShare) != CURLSHE_OK)
+	{
+		LOG(WARNING, "curl share handle is still in use");
+	}
+}
+
+void ConnectionPool::ShareLock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp)
+{
+	ConnectionPool *pool = (ConnectionPool *)userp;
+	pool->mShareLocks[data].lock();
+}
+
+void ConnectionPool::ShareUnlock(CURL *curl, curl_lock_data data, void *userp)
+{
+	ConnectionPool *pool = (ConnectionPool *)userp;
+	pool->mShareLocks[data].unlock();
+}
+
+void ConnectionPool::prepare(CURL *curl)
+{
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_SHARE, mShare);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	if (mHttp2)
+	{
+		/*
+		 * HTTP/2 over TLS only, a plain http endpoint keeps talking HTTP/1.1.
+		 * PIPEWAIT makes concurrent transfers wait for the connection being set
+		 * up and multiplex on it, rather than each opening its own.
+		 */
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+		return;
+	}
+#endif
+	/* newer libcurl negotiates h2 by default, keep it opt-in */
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_1_1);
+}
+
+CURL *ConnectionPool::acquire(const std::string &host)
+{
+	CURL *curl = NULL;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		std::map<std::string, std::list<CURL *> >::iterator itr = mIdleHandles.find(host);
+		if (itr != mIdleHandles.end() && !itr->second.empty())
+		{
+			/* most recently used first, its connection is the least likely to be timed out */
+			curl = itr->second.back();
+			itr->second.pop_back();
+			mNIdle--;
+			mHits++;
+		}
+		else
+		{
+			mMisses++;
+		}
+	}
+
+	if (curl)
+	{
+		reset(curl);
+	}
+	else
+	{
+		curl = curl_easy_init();
+		if (!curl)
+		{
+			THROW(OutOfMemoryException, "could not create curl instance");
+		}
+		prepare(curl);
+	}
+
+	return curl;
+}
+
+CURL *ConnectionPool::create()
+{
+	CURL *curl = curl_easy_init();
+	if (!curl)
+	{
+		THROW(OutOfMemoryException, "could not create curl instance");
+	}
+	prepare(curl);
+	return curl;
+}
+
+void ConnectionPool::reset(CURL *curl)
+{
+	/*
+	 * curl_easy_reset() keeps the live connections, the DNS cache and the
+	 * TLS session cache of the handle.
+	 */
+	curl_easy_reset(curl);
+	prepare(curl);
+}
+
+void ConnectionPool::release(const std::string &host, CURL *curl, bool reusable)
+{
+	if (!curl)
+	{
+		return;
+	}
+
+	if (reusable)
+	{
+		lock_guard<mutex> lock(mMutex);
+		std::list<CURL *> &handles = mIdleHandles[host];
+		if (static_cast<int>(handles.size()) < mMaxIdlePerHost)
+		{
+			handles.push_back(curl);
+			mNIdle++;
+			return;
+		}
+		mDiscards++;
+	}
+	else
+	{
+		lock_guard<mutex> lock(mMutex);
+		mDiscards++;
+	}
+
+	LOG(DEBUG2, "discard curl handle %p for host %s", curl, host.c_str());
+	curl_easy_cleanup(curl);
+}
+
+ConnectionPoolStats ConnectionPool::stats()
+{
+	lock_guard<mutex> lock(mMutex);
+	ConnectionPoolStats result;
+	result.hits = mHits;
+	result.misses = mMisses;
+	result.discards = mDiscards;
+	result.idle = mNIdle;
+	return result;
+}
+
+}
+}
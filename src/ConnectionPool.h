@@ -0,0 +1,137 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_CONNECTIONPOOL_H_
+#define __QINGSTOR_LIBQINGSTOR_CONNECTIONPOOL_H_
+
+#include "Thread.h"
+
+#include <curl/curl.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+namespace QingStor {
+namespace Internal {
+
+class ConnectionPoolStats {
+public:
+	int64_t hits;			/* handles served from the idle list */
+	int64_t misses;			/* handles that had to be created */
+	int64_t discards;		/* handles destroyed instead of being kept */
+	int32_t idle;			/* handles currently parked in the pool */
+};
+
+/*
+ * A pool of CURL easy handles, keyed by host.
+ *
+ * A handle run with curl_easy_perform() keeps its connection open after the
+ * transfer, so borrowing a handle that was used for the same host before
+ * skips the TCP and TLS handshake. The pool is owned by a Context and is
+ * thread safe.
+ *
+ * Every handle of the pool is attached to one CURLSH, so all the handles of
+ * a context share the DNS cache and the TLS session ids: a handle that opens
+ * a new connection resolves nothing and resumes the TLS session. The
+ * connection cache is not shared: the handles are driven by several threads
+ * at once, which libcurl does not support for shared connections.
+ *
+ * A handle run on a multi handle leaves its connection in the cache of that
+ * multi instead. Such handles come from create() and never go to the idle
+ * handles, where they would pass for a kept-alive connection.
+ */
+class ConnectionPool {
+public:
+	/*
+	 * With http2 set, handles ask for HTTP/2 through ALPN and fall back to
+	 * HTTP/1.1 on their own when the server does not agree to it.
+	 */
+	ConnectionPool(int maxIdlePerHost, bool http2 = false);
+
+	bool http2() {
+		return mHttp2;
+	}
+
+	~ConnectionPool();
+
+	/*
+	 * Borrow a handle for the given host. The returned handle has all its
+	 * options reset.
+	 */
+	CURL *acquire(const std::string &host);
+
+	/*
+	 * Create a handle with the options of the pool, for a borrower that runs
+	 * it on a multi handle of its own. The borrower keeps it between its
+	 * transfers and destroys it with curl_easy_cleanup(). Not counted in the
+	 * stats.
+	 */
+	CURL *create();
+
+	/*
+	 * Give back a handle got by acquire(). If reusable is false, e.g. the
+	 * transfer failed half way, or there are enough idle handles for the host
+	 * already, the handle is destroyed.
+	 */
+	void release(const std::string &host, CURL *curl, bool reusable = true);
+
+	/*
+	 * Clear the options of a handle that stays with its borrower between
+	 * transfers, and set the pool defaults again. The connection is kept.
+	 */
+	void reset(CURL *curl);
+
+	ConnectionPoolStats stats();
+
+private:
+	mutex mMutex;
+
+	CURLSH *mShare;
+	mutex mShareLocks[CURL_LOCK_DATA_LAST];
+
+	std::map<std::string, std::list<CURL *> > mIdleHandles;
+	int mMaxIdlePerHost;
+	bool mHttp2;
+	int32_t mNIdle;
+
+	int64_t mHits;
+	int64_t mMisses;
+	int64_t mDiscards;
+
+	/*
+	 * Set the options every handle of the pool should carry.
+	 */
+	void prepare(CURL *curl);
+
+	/*
+	 * Lock callbacks of the share, a handle may be used by any thread.
+	 */
+	static void ShareLock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp);
+
+	static void ShareUnlock(CURL *curl, curl_lock_data data, void *userp);
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_CONNECTIONPOOL_H_ */
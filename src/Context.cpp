@@ -25,6 +25,7 @@
 #include "QingStorCommon.h"
 #include "Exception.h"
 #include "ExceptionInternal.h"
+#include "Logger.h"
 
 #include <stdlib.h>
 
@@ -45,11 +46,159 @@ ObjectContentComp(const void *a_, const void *b_)
 Context::Context(std::string location, std::string access_key_id, std::string secret_access_key, int64_t chunk_size)
 {
 	mConfiguration = shared_ptr<Configuration> (new Configuration(location, access_key_id, secret_access_key, chunk_size));
+	init();
 }
 
 Context::Context(std::string config_file)
 {
 	mConfiguration = shared_ptr<Configuration> (new Configuration(config_file));
+	init();
+}
+
+void Context::init()
+{
+	mConnectionPool = shared_ptr<ConnectionPool> (new ConnectionPool(mConfiguration->mMaxIdleConnections,
+								mConfiguration->mEnableHttp2));
+	mTransferScheduler = shared_ptr<TransferScheduler> (new TransferScheduler(mConfiguration->mMaxTransfersPerHost));
+	mPartBufferPool = shared_ptr<PartBufferPool> (new PartBufferPool(mConfiguration->mPartBufferLimit));
+	mUploadEngine = shared_ptr<UploadEngine> (new UploadEngine(mConnectionPool, mTransferScheduler,
+								mConfiguration->mConnectionRetries));
+	/* as many threads as connections a prewarm may open at once */
+	mBackgroundWorker = shared_ptr<BackgroundWorker> (new BackgroundWorker(
+								mConfiguration->mMaxIdleConnections > 0 ? mConfiguration->mMaxIdleConnections : 1));
+	mCloseWorker = shared_ptr<BackgroundWorker> (new BackgroundWorker(mConfiguration->mCloseConcurrency));
+
+	if (!mConfiguration->mSpoolDir.empty())
+	{
+		mSpoolUploader = shared_ptr<SpoolUploader> (new SpoolUploader(this, mConfiguration->mSpoolDir,
+								mConfiguration->mSpoolLimit, mConfiguration->mConnectionRetries));
+	}
+
+	if (!mConfiguration->mPrewarmBucket.empty() && mConfiguration->mPrewarmConnections > 0)
+	{
+		prewarm(mConfiguration->mPrewarmBucket, mConfiguration->mPrewarmConnections);
+	}
+}
+
+/*
+ * The handles of a prewarm. They are given back to the pool together, once
+ * the last connection is open, so that none of them is taken again to open
+ * another one.
+ */
+class PrewarmBatch {
+public:
+	PrewarmBatch(shared_ptr<ConnectionPool> pool, const std::string &bucket, const std::string &host,
+				const std::string &url, const QSCredential &cred, int nconnections)
+				: mPool(pool), mBucket(bucket), mHost(host), mUrl(url), mCred(cred),
+				  mNConnections(nconnections), mNOpened(0) {
+	}
+
+	~PrewarmBatch() {
+		for (size_t i = 0; i < mHandles.size(); i++)
+		{
+			mPool->release(mHost, mHandles[i]);
+		}
+		LOG(INFO, "prewarmed %d of %d connections to %s", mNOpened, mNConnections, mHost.c_str());
+	}
+
+	/*
+	 * Open a connection with a signed HEAD of the bucket on a handle of its
+	 * own, with curl_easy_perform() so that the connection stays with the
+	 * handle. The answer does not matter. Run by a background thread.
+	 */
+	void open() {
+		CURL *curl = NULL;
+		struct curl_slist *chunk = NULL;
+
+		try {
+			curl = mPool->acquire(mHost);
+
+			HeaderContent header;
+			HeaderContent_Add(&header, HOST, mHost.c_str());
+			std::string path = "/" + mBucket;
+			Signature(&header, path.c_str(), &mCred, QSRT_HEAD_OBJECT, NULL);
+			chunk = HeaderContent_GetList(&header);
+		} catch (const QingStorException & e)
+		{
+			LOG(WARNING, "prewarm of %s failed: %s", mHost.c_str(), e.what());
+			if (curl)
+			{
+				mPool->release(mHost, curl, false);
+			}
+			return;
+		}
+
+		curl_easy_setopt(curl, CURLOPT_URL, mUrl.c_str());
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+		CURLcode res = curl_easy_perform(curl);
+		curl_slist_free_all(chunk);
+
+		if (res != CURLE_OK)
+		{
+			LOG(WARNING, "prewarm of %s failed: %s", mHost.c_str(), curl_easy_strerror(res));
+			mPool->release(mHost, curl, false);
+			return;
+		}
+
+		lock_guard<mutex> lock(mMutex);
+		mHandles.push_back(curl);
+		mNOpened++;
+	}
+
+private:
+	shared_ptr<ConnectionPool> mPool;
+	std::string mBucket;
+	std::string mHost;
+	std::string mUrl;
+	QSCredential mCred;
+	int mNConnections;
+
+	mutex mMutex;
+	std::vector<CURL *> mHandles;
+	int mNOpened;
+};
+
+void Context::prewarm(std::string bucket, int nconnections)
+{
+	if (bucket.empty())
+	{
+		THROW(InvalidParameter, "bucket name is empty");
+	}
+	if (nconnections <= 0)
+	{
+		nconnections = mConfiguration->mPrewarmConnections;
+	}
+
+	/* more than this would be discarded by the pool right away */
+	if (nconnections > mConfiguration->mMaxIdleConnections)
+	{
+		nconnections = mConfiguration->mMaxIdleConnections;
+	}
+	if (nconnections <= 0)
+	{
+		return;
+	}
+
+	std::stringstream sstr;
+	sstr<<bucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/";
+
+	QSCredential cred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
+	shared_ptr<PrewarmBatch> batch(new PrewarmBatch(mConnectionPool, bucket, host, sstr.str(), cred,
+							nconnections));
+	for (int i = 0; i < nconnections; i++)
+	{
+		if (!mBackgroundWorker->submit(bind(&PrewarmBatch::open, batch)))
+		{
+			break;
+		}
+	}
 }
 
 shared_ptr<ListBucketResult> Context::listBuckets(std::string location)
@@ -66,12 +215,14 @@ shared_ptr<ListBucketResult> Context::listBuckets(std::string location)
 			if (location.empty())
 			{
 				resp_body = DoGetJSON(mConfiguration->mHost.c_str(), sstr.str().c_str(), NULL,
-									NULL, &cred, QSRT_LIST_BUCKET, NULL, mConfiguration->mConnectionRetries);
+									NULL, &cred, QSRT_LIST_BUCKET, NULL, mConfiguration->mConnectionRetries,
+									mConnectionPool.get());
 			}
 			else
 			{
 				resp_body = DoGetJSON(mConfiguration->mHost.c_str(), sstr.str().c_str(), NULL,
-									location.c_str(), &cred, QSRT_LIST_BUCKET, NULL, mConfiguration->mConnectionRetries);
+									location.c_str(), &cred, QSRT_LIST_BUCKET, NULL, mConfiguration->mConnectionRetries,
+									mConnectionPool.get());
 			}
 			if (!resp_body)
 			{
@@ -147,7 +298,8 @@ shared_ptr<ListObjectResult> Context::listObjects(std::string bucket, std::strin
 
 		try {
 			resp_body = DoGetJSON(host.c_str(), sstr.str().c_str(),
-								bucket.c_str(), NULL, &cred, QSRT_LIST_OBJECT, NULL, mConfiguration->mConnectionRetries);
+								bucket.c_str(), NULL, &cred, QSRT_LIST_OBJECT, NULL, mConfiguration->mConnectionRetries,
+								mConnectionPool.get());
 			if (!resp_body)
 			{
 				THROW(QingStorNetworkException, "could not list bucket \"%s\"", sstr.str().c_str());
@@ -393,7 +545,8 @@ shared_ptr<HeadObjectResult> Context::headObject(std::string bucket, std::string
 		QSCredential cred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
 
 		try {
-			resp_body = DoGetJSON(host.c_str(), sstr.str().c_str(), bucket.c_str(), NULL, &cred, QSRT_HEAD_OBJECT, NULL, mConfiguration->mConnectionRetries);
+			resp_body = DoGetJSON(host.c_str(), sstr.str().c_str(), bucket.c_str(), NULL, &cred, QSRT_HEAD_OBJECT, NULL, mConfiguration->mConnectionRetries,
+											mConnectionPool.get());
 			if (!resp_body)
 			{
 				THROW(QingStorNetworkException, "could not head object \"%s\"", sstr.str().c_str());
@@ -450,7 +603,8 @@ void Context::createBucket(std::string location, std::string bucket)
 	do {
 		try {
 			resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL, &cred,
-											QSRT_CREATE_BUCKET, NULL, mConfiguration->mConnectionRetries);
+											QSRT_CREATE_BUCKET, NULL, mConfiguration->mConnectionRetries,
+											mConnectionPool.get());
 		} catch (QingStorException & e)
 		{
 			/* always clean up */
@@ -494,7 +648,8 @@ void Context::deleteBucket(std::string location, std::string bucket)
 	do {
 		try {
 			resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL, &cred,
-											QSRT_DELETE_BUCKET, NULL, mConfiguration->mConnectionRetries);
+											QSRT_DELETE_BUCKET, NULL, mConfiguration->mConnectionRetries,
+											mConnectionPool.get());
 		} catch (QingStorException & e)
 		{
 			/* always clean up */
@@ -532,7 +687,8 @@ void Context::deleteObject(std::string bucket, std::string key)
 	do {
 		try {
 			resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL, &cred,
-											QSRT_DELETE_OBJECT, NULL, mConfiguration->mConnectionRetries);
+											QSRT_DELETE_OBJECT, NULL, mConfiguration->mConnectionRetries,
+											mConnectionPool.get());
 		} catch (QingStorException & e)
 		{
 			/* always clean up */
@@ -25,6 +25,12 @@
 
 #include "Memory.h"
 #include "Configuration.h"
+#include "ConnectionPool.h"
+#include "BackgroundWorker.h"
+#include "PartBufferPool.h"
+#include "SpoolUploader.h"
+#include "TransferScheduler.h"
+#include "UploadEngine.h"
 
 #include <json/json.h>
 
@@ -105,8 +111,82 @@ public:
 		return mConfiguration;
 	}
 
+	/*
+	 * Keep-alive handles shared by every request issued through this context.
+	 */
+	shared_ptr<ConnectionPool> connectionPool() {
+		return mConnectionPool;
+	}
+
+	/*
+	 * Caps the transfers in flight to a host over all the readers and writers
+	 * of this context.
+	 */
+	shared_ptr<TransferScheduler> transferScheduler() {
+		return mTransferScheduler;
+	}
+
+	/*
+	 * The part buffers of the writers of this context, capped by
+	 * part_buffer_limit.
+	 */
+	shared_ptr<PartBufferPool> partBufferPool() {
+		return mPartBufferPool;
+	}
+
+	/*
+	 * Sends the parts of writers with upload_concurrency above 1 in the
+	 * background.
+	 */
+	shared_ptr<UploadEngine> uploadEngine() {
+		return mUploadEngine;
+	}
+
+	/*
+	 * Uploads the objects of spooled writers from spool_dir, NULL if no
+	 * spool directory is configured.
+	 */
+	shared_ptr<SpoolUploader> spoolUploader() {
+		return mSpoolUploader;
+	}
+
+	/*
+	 * Closes the writers handed over by qingstorCloseObjectAsync, up to
+	 * close_concurrency of them at a time.
+	 */
+	shared_ptr<BackgroundWorker> closeWorker() {
+		return mCloseWorker;
+	}
+
+	/*
+	 * Open nconnections keep-alive connections to the endpoint of the bucket
+	 * in the background, each on a handle of the connection pool, and park
+	 * the handles there for the next requests to the bucket. With
+	 * nconnections <= 0 the number configured by prewarm_connections is used.
+	 *
+	 * A connection stays with the handle it was opened on, so only requests
+	 * sent on a single handle use them: object heads, qingstorPread, and the
+	 * parts of writers with upload_concurrency 1. The pipelines of readers and
+	 * of the upload engine open connections of their own, and only find the
+	 * DNS cache and the TLS sessions warm.
+	 */
+	void prewarm(std::string bucket, int nconnections);
+
 private:
 	shared_ptr<Configuration> mConfiguration;
+	shared_ptr<ConnectionPool> mConnectionPool;
+	shared_ptr<TransferScheduler> mTransferScheduler;
+	shared_ptr<PartBufferPool> mPartBufferPool;
+
+	/* declared after the pools, so that their tasks are over before the pools go */
+	shared_ptr<UploadEngine> mUploadEngine;
+	shared_ptr<BackgroundWorker> mBackgroundWorker;
+	shared_ptr<BackgroundWorker> mCloseWorker;
+
+	/* uploads through all of the above, it goes first */
+	shared_ptr<SpoolUploader> mSpoolUploader;
+
+	void init();
 
 	bool extractListObjectContent(shared_ptr<ListObjectResult> result, struct json_object *resp_body,
 								shared_ptr<std::string> current_marker, bool *eof);
@@ -28,15 +28,30 @@
 namespace QingStor {
 namespace Internal {
 
-DownloadPipeline::DownloadPipeline(int nconnections)
+DownloadPipeline::DownloadPipeline(int nconnections, shared_ptr<ConnectionPool> pool,
+							shared_ptr<TransferScheduler> scheduler, std::string host)
+							: mPool(pool),
+							  mHost(host),
+							  mScheduler(scheduler)
 {
 	mNConnections = nconnections;
+	mBorrowed = 0;
 
 	mCurlMHandle = curl_multi_init();
 	if (NULL == mCurlMHandle)
 	{
 		THROW(QingStorException, "could not create CURL multi-handle");
 	}
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (mPool->http2())
+	{
+		/*
+		 * all range requests of the object go over one HTTP/2 connection,
+		 * or mNConnections HTTP/1.1 ones if the server does not speak h2.
+		 */
+		curl_multi_setopt(mCurlMHandle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	}
+#endif
 }
 
 void DownloadPipeline::launch()
@@ -53,16 +68,88 @@ void DownloadPipeline::launch()
 			break;
 		}
 		fetcher = mPendingFetchers.front();
+
+		/*
+		 * With nothing active, the caller is waiting for this very fetcher,
+		 * and has nothing else to do until it gets a slot. Otherwise it is
+		 * prefetching, and asks again on the next read.
+		 */
+		if (mActiveFetchers.empty())
+		{
+			mScheduler->acquireDemand(mHost, this);
+		}
+		else if (!mScheduler->acquire(mHost, this, false))
+		{
+			break;
+		}
 		mPendingFetchers.pop_front();
 
 		/* Move it to the active list, and start it */
 		mActiveFetchers.push_back(fetcher);
 
-		fetcher->start(mCurlMHandle);
+		startFetcher(fetcher);
+	}
+}
+
+void DownloadPipeline::startFetcher(shared_ptr<HTTPFetcher> fetcher)
+{
+	CURL *curl;
+
+	if (!mIdleHandles.empty())
+	{
+		curl = mIdleHandles.front();
+		mIdleHandles.pop_front();
+		mPool->reset(curl);
+	}
+	else
+	{
+		curl = mPool->create();
+	}
+
+	try {
+		fetcher->start(mCurlMHandle, curl);
+	} catch (...) {
+		fetcher->release();
+		mIdleHandles.push_back(curl);
+		mScheduler->release(mHost, this);
+		throw;
+	}
+}
+
+void DownloadPipeline::recycle(shared_ptr<HTTPFetcher> fetcher)
+{
+	CURL *curl = fetcher->release();
+
+	if (curl)
+	{
+		mIdleHandles.push_back(curl);
+		mScheduler->release(mHost, this);
 	}
 }
 
 int DownloadPipeline::read(char *buff, int bufflen, bool *eof_p)
+{
+	mBorrowed = 0;
+	return fetch(buff, bufflen, NULL, eof_p);
+}
+
+int DownloadPipeline::borrow(const char **data, bool *eof_p)
+{
+	mBorrowed = fetch(NULL, 0, data, eof_p);
+	return mBorrowed;
+}
+
+void DownloadPipeline::consume(int len)
+{
+	if (len < 0 || len > mBorrowed || mActiveFetchers.empty())
+	{
+		THROW(InvalidParameter, "%d bytes are borrowed, %d cannot be released", mBorrowed, len);
+	}
+	mActiveFetchers.front()->consume(len);
+	mBorrowed -= len;
+}
+
+int DownloadPipeline::fetch(char *buff, int bufflen, const char **borrowed, bool *eof_p)
 {
 	shared_ptr<HTTPFetcher> current_fetcher;
 	int r;
@@ -88,7 +175,14 @@ int DownloadPipeline::read(char *buff, int bufflen, bool *eof_p)
 		/*
 		 * Try to read from the current fetcher
 		 */
-		r = current_fetcher->get(buff, bufflen, &eof);
+		if (buff)
+		{
+			r = current_fetcher->get(buff, bufflen, &eof);
+		}
+		else
+		{
+			r = current_fetcher->borrow(borrowed, &eof);
+		}
 		if (eof)
 		{
 			mActiveFetchers.pop_front();
@@ -108,10 +202,22 @@ int DownloadPipeline::read(char *buff, int bufflen, bool *eof_p)
 		 * pre-fetching ones. Hopefully requests don't fail often enough for that
 		 * to matter.
 		 */
+		/*
+		 * The prefetching fetchers keep running meanwhile, so do not block
+		 * for a slot but ask again after waiting for them below.
+		 */
+		int waitMs = 1000;
 		if (current_fetcher->state() == FETCHER_FAILED)
 		{
-			LOG(DEBUG1, "retrying now");
-			current_fetcher->start(mCurlMHandle);
+			if (mScheduler->acquire(mHost, this, true))
+			{
+				LOG(DEBUG1, "retrying now");
+				startFetcher(current_fetcher);
+			}
+			else
+			{
+				waitMs = 100;
+			}
 		}
 
 		{
@@ -122,7 +228,7 @@ int DownloadPipeline::read(char *buff, int bufflen, bool *eof_p)
 			/*
 			 * Got nothing. Wait until something happens.
 			 */
-			mres = curl_multi_wait(mCurlMHandle, NULL, 0, 1000, NULL);
+			mres = curl_multi_wait(mCurlMHandle, NULL, 0, waitMs, NULL);
 			if (mres != CURLM_OK)
 			{
 				THROW(QingStorNetworkException, "curl_multi_perform returned error: %s",
@@ -154,6 +260,7 @@ int DownloadPipeline::read(char *buff, int bufflen, bool *eof_p)
 						{
 							found = true;
 							f->handleResult(m->data.result);
+							recycle(f);
 							break;
 						}
 						itr++;
@@ -175,12 +282,65 @@ void DownloadPipeline::add(shared_ptr<HTTPFetcher> fetcher)
 	mPendingFetchers.push_back(fetcher);
 }
 
-DownloadPipeline::~DownloadPipeline()
+void DownloadPipeline::clear()
 {
 	while (!mActiveFetchers.empty())
 	{
+		recycle(mActiveFetchers.front());
+		mActiveFetchers.pop_front();
+	}
+	mPendingFetchers.clear();
+}
+
+bool DownloadPipeline::seek(int64_t target)
+{
+	mBorrowed = 0;
+
+	while (!mActiveFetchers.empty() && mActiveFetchers.front()->end() <= target)
+	{
+		recycle(mActiveFetchers.front());
 		mActiveFetchers.pop_front();
 	}
+	if (!mActiveFetchers.empty())
+	{
+		shared_ptr<HTTPFetcher> fetcher = mActiveFetchers.front();
+		if (target < fetcher->position())
+		{
+			clear();
+			return false;
+		}
+		fetcher->seek(target);
+		if (fetcher->state() == FETCHER_FAILED)
+		{
+			/* read() starts it again */
+			recycle(fetcher);
+		}
+		return true;
+	}
+
+	/* all the active fetchers were behind, the pending ones are not started yet */
+	while (!mPendingFetchers.empty() && mPendingFetchers.front()->end() <= target)
+	{
+		mPendingFetchers.pop_front();
+	}
+	if (mPendingFetchers.empty() || target < mPendingFetchers.front()->position())
+	{
+		clear();
+		return false;
+	}
+	mPendingFetchers.front()->seek(target);
+	return true;
+}
+
+DownloadPipeline::~DownloadPipeline()
+{
+	clear();
+	while (!mIdleHandles.empty())
+	{
+		curl_easy_cleanup(mIdleHandles.front());
+		mIdleHandles.pop_front();
+	}
+	mScheduler->unregister(mHost, this);
 	if (mCurlMHandle)
 	{
 		curl_multi_cleanup(mCurlMHandle);
@@ -24,9 +24,12 @@
 #define __QINGSTOR_LIBQINGSTOR_DOWNLOADPIPELINE_H_
 
 #include "HTTPFetcher.h"
+#include "ConnectionPool.h"
+#include "TransferScheduler.h"
 #include "Memory.h"
 
 #include <list>
+#include <string>
 
 namespace QingStor {
 namespace Internal {
@@ -34,7 +37,8 @@ namespace Internal {
 class DownloadPipeline
 {
 public:
-	DownloadPipeline(int nconnections);
+	DownloadPipeline(int nconnections, shared_ptr<ConnectionPool> pool,
+					shared_ptr<TransferScheduler> scheduler, std::string host);
 
 	~DownloadPipeline();
 
@@ -43,8 +47,30 @@ public:
 	 */
 	int read(char *buff, int bufflen, bool *eof);
 
+	/*
+	 * Point data at the next bytes in the buffer of a fetcher, and return
+	 * how many there are in a row. Blocks as read() does. The bytes stay
+	 * valid until consume() or read() moves past them.
+	 */
+	int borrow(const char **data, bool *eof);
+
+	/*
+	 * Move past len of the bytes returned by borrow().
+	 */
+	void consume(int len);
+
 	void add(shared_ptr<HTTPFetcher> fetcher);
 
+	/*
+	 * Go on reading from target. The fetchers whose range is behind it are
+	 * dropped, and the one holding it goes on from there, keeping what it
+	 * buffered past target, as do the prefetching ones after it. Returns
+	 * false if no fetcher is left then, the caller is to add fetchers from
+	 * target on. That is the case of a target before the data of the
+	 * fetchers as well, which are all dropped.
+	 */
+	bool seek(int64_t target);
+
 private:
 	/*
 	 * Fetchers that have been started. The first one in the list is
@@ -54,17 +80,62 @@ private:
 	std::list<shared_ptr<HTTPFetcher> > mActiveFetchers;
 	std::list<shared_ptr<HTTPFetcher> > mPendingFetchers;	/* fetchers not started yet */
 
+	int mBorrowed;		/* bytes returned by borrow() and not consumed yet */
+
 	/* number of active connections to use */
 	int mNConnections;
 
 	/* Multi-handle that contains the currently active fetcher's CURL handle */
 	CURLM *mCurlMHandle;
 
+	/*
+	 * Easy handles of finished fetchers, kept for the next fetcher. The
+	 * multi-handle keeps their connections open, so a chunked download runs over
+	 * the same mNConnections connections from the first range to the last. The
+	 * connections go with the multi-handle, so the handles are destroyed with
+	 * the pipeline rather than given back to the connection pool.
+	 */
+	std::list<CURL *> mIdleHandles;
+
+	/* where the handles come from, and go back to when the pipeline is done */
+	shared_ptr<ConnectionPool> mPool;
+	std::string mHost;
+
+	/*
+	 * Every fetcher holding a handle holds a transfer slot of the context too.
+	 * Only the fetcher the caller reads from next is sure to get one, the
+	 * prefetching ones wait while other readers and writers use the host.
+	 */
+	shared_ptr<TransferScheduler> mScheduler;
+
 	/*
 	 * If there are less than the requested number of downloads active currently,
-	 * launch more from the pending list.
+	 * and the scheduler lets us, launch more from the pending list.
 	 */
 	void launch();
+
+	/*
+	 * Start a fetcher on an idle handle, or a new one if there is no idle handle.
+	 * The caller got a transfer slot for it already.
+	 */
+	void startFetcher(shared_ptr<HTTPFetcher> fetcher);
+
+	/*
+	 * Take the handle back from a fetcher whose transfer is over, and give
+	 * back its transfer slot.
+	 */
+	void recycle(shared_ptr<HTTPFetcher> fetcher);
+
+	/*
+	 * Drop all the fetchers.
+	 */
+	void clear();
+
+	/*
+	 * Wait for data as read() does, and copy it into buff, or point borrowed
+	 * at it if buff is NULL.
+	 */
+	int fetch(char *buff, int bufflen, const char **borrowed, bool *eof);
 };
 
 }
@@ -115,6 +115,17 @@ public:
     }
 };
 
+class QingStorWouldBlock: public QingStorException {
+public:
+    QingStorWouldBlock(const std::string & arg, const char * file, int line,
+                 const char * stack) :
+        QingStorException(arg, file, line, stack) {
+    }
+
+    ~QingStorWouldBlock() throw () {
+    }
+};
+
 class QingStorConfigInvalid: public QingStorException {
 public:
     QingStorConfigInvalid(const std::string & arg, const char * file, int line,
@@ -40,35 +40,39 @@ HTTPFetcher::WriterCallback(void *contents, size_t size, size_t nmemb, void *use
 	size_t realsize = size * nmemb;
 	HTTPFetcher *fetcher = (HTTPFetcher *)userp;
 
-	if (fetcher->mNused == fetcher->mReadOff)
+	if (fetcher->mSkip > 0)
 	{
-		fetcher->mNused = fetcher->mReadOff = 0;
-	}
-
-	if (realsize > fetcher->mBuffSize - fetcher->mNused)
-	{
-		if (fetcher->mReadOff > 0)
+		size_t skip = (int64_t)realsize < fetcher->mSkip ? realsize : fetcher->mSkip;
+		fetcher->mSkip -= skip;
+		contents = (char *)contents + skip;
+		realsize -= skip;
+		if (realsize == 0)
 		{
-			/*
-			 * Shift the valid data in the buffer to make room for more
-			 */
-			memmove(fetcher->mReadBuff,
-					fetcher->mReadBuff + fetcher->mReadOff,
-					fetcher->mNused - fetcher->mReadOff);
-			fetcher->mNused -= fetcher->mReadOff;
-			fetcher->mReadOff = 0;
+			return skip;
 		}
-
+		/* the rest is taken whole, or the skip would be counted twice when curl comes back */
 		if (realsize > fetcher->mBuffSize - fetcher->mNused)
 		{
+			fetcher->mSkip += skip;
 			fetcher->mPaused = true;
-			LOG(DEBUG2, "paused %s (%d bytes in buffer, size %d)",
-					fetcher->mUrl, (int) fetcher->mNused, (int) fetcher->mBuffSize);
 			return CURL_WRITEFUNC_PAUSE;
 		}
+		return skip + WriterCallback(contents, 1, realsize, userp);
+	}
+
+	/* curl takes all of it or nothing, the write waits for the room */
+	if (realsize > fetcher->mBuffSize - fetcher->mNused)
+	{
+		fetcher->mPaused = true;
+		LOG(DEBUG2, "paused %s (%d bytes in buffer, size %d)",
+				fetcher->mUrl, (int) fetcher->mNused, (int) fetcher->mBuffSize);
+		return CURL_WRITEFUNC_PAUSE;
 	}
 
-	memcpy(fetcher->mReadBuff + fetcher->mNused, contents, realsize);
+	size_t tail = (fetcher->mReadOff + fetcher->mNused) % fetcher->mBuffSize;
+	size_t first = fetcher->mBuffSize - tail < realsize ? fetcher->mBuffSize - tail : realsize;
+	memcpy(fetcher->mReadBuff + tail, contents, first);
+	memcpy(fetcher->mReadBuff, (char *)contents + first, realsize - first);
 	fetcher->mNused += realsize;
 	return realsize;
 }
@@ -85,9 +89,11 @@ HTTPFetcher::HTTPFetcher(const char *url, const char *host, const char *bucket,
 						  mLen(len)
 {
 	mPaused = false;
+	mCurl = NULL;
 	mHttpHeaders = NULL;
 	mParent = NULL;
 	mBytesDone = 0;
+	mSkip = 0;
 	mReadBuff = 0;
 	mBuffSize = 0;
 	mNused = 0;
@@ -96,9 +102,8 @@ HTTPFetcher::HTTPFetcher(const char *url, const char *host, const char *bucket,
 	mNFailures = 0;
 }
 
-void HTTPFetcher::start(CURLM *curl_mhandle)
+void HTTPFetcher::start(CURLM *curl_mhandle, CURL *curl)
 {
-	CURL *curl;
 	char *path;
 	char *query;
 	std::stringstream sstr;
@@ -118,29 +123,29 @@ void HTTPFetcher::start(CURLM *curl_mhandle)
 		THROW(QingStorException, "invalid fetcher state");
 	}
 
-	curl = curl_easy_init();
 	if (!curl)
 	{
 		THROW(QingStorNetworkException, "could not create curl handle");
 	}
 	mCurl = curl;
 
-	curl_multi_add_handle(curl_mhandle, mCurl);
-	mParent = curl_mhandle;
-
 	curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, HTTPFetcher::WriterCallback);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
-	curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
 	curl_easy_setopt(curl, CURLOPT_URL, mUrl);
 
+	/* a retry asks for the range from where the data stops, nothing to skip */
+	mSkip = 0;
+
+	/* a retry signs the request again */
+	mHeaders.fields.clear();
 	HeaderContent_Add(&mHeaders, HOST, mHost);
 
 	if ((mOffset + mBytesDone > 0) || (mLen >= 0))
 	{
-		int64_t offset = mOffset + (mNused - mReadOff) + mBytesDone;
-		int64_t len = mLen - (mNused - mReadOff) - mBytesDone;
+		int64_t offset = mOffset + mNused + mBytesDone;
+		int64_t len = mLen - mNused - mBytesDone;
 		char rangebuf[128];
 
 		if (len >= 0)
@@ -189,6 +194,10 @@ void HTTPFetcher::start(CURLM *curl_mhandle)
 	mHttpHeaders = HeaderContent_GetList(&mHeaders);
 	curl_easy_setopt(mCurl, CURLOPT_HTTPHEADER, mHttpHeaders);
 
+	/* add it only once it is fully set up, the multi-handle may start it right away */
+	curl_multi_add_handle(curl_mhandle, mCurl);
+	mParent = curl_mhandle;
+
 	mState = FETCHER_RUNNING;
 
 	LOG(DEBUG1, "starting download from %s (off %ld, len %d)",
@@ -206,8 +215,10 @@ HTTPFetcher::~HTTPFetcher()
 	}
 }
 
-void HTTPFetcher::cleanup()
+CURL *HTTPFetcher::release()
 {
+	CURL *curl = mCurl;
+
 	if (mCurl)
 	{
 		if (mParent)
@@ -215,20 +226,31 @@ void HTTPFetcher::cleanup()
 			curl_multi_remove_handle(mParent, mCurl);
 			mParent = NULL;
 		}
-		curl_easy_cleanup(mCurl);
 		mCurl = NULL;
 	}
+	mPaused = false;
 
 	if (mHttpHeaders)
 	{
 		curl_slist_free_all(mHttpHeaders);
 		mHttpHeaders = NULL;
 	}
+
+	return curl;
+}
+
+void HTTPFetcher::cleanup()
+{
+	CURL *curl = release();
+
+	if (curl)
+	{
+		curl_easy_cleanup(curl);
+	}
 }
 
 void HTTPFetcher::fail()
 {
-	cleanup();
 	mState = FETCHER_FAILED;
 	mNFailures++;
 
@@ -238,37 +260,126 @@ void HTTPFetcher::fail()
 
 void HTTPFetcher::done()
 {
-	cleanup();
 	mState = FETCHER_DONE;
 
 	LOG(DEBUG1, "download from %s (off %ld, len %d) is completed",
 			mUrl, mOffset, mLen);
 }
 
+void HTTPFetcher::resumeIfRoom()
+{
+	size_t room = mBuffSize / 2 > CURL_MAX_WRITE_SIZE ? mBuffSize / 2 : CURL_MAX_WRITE_SIZE;
+
+	if (mPaused && mCurl && (mNused == 0 || mBuffSize - mNused >= room))
+	{
+		LOG(DEBUG2, "unpaused %s", mUrl);
+		mPaused = false;
+		curl_easy_pause(mCurl, CURLPAUSE_CONT);
+	}
+}
+
 int HTTPFetcher::get(char *buff, int bufflen, bool *eof)
+{
+	int total = 0;
+
+	/* the data may wrap around the end of the ring, it comes in two pieces then */
+	while (total < bufflen)
+	{
+		const char *data;
+		int avail = borrow(&data, eof);
+		if (avail == 0)
+		{
+			break;
+		}
+		if (avail > bufflen - total)
+		{
+			avail = bufflen - total;
+		}
+		memcpy(buff + total, data, avail);
+		consume(avail);
+		total += avail;
+	}
+
+	if (total > 0)
+	{
+		*eof = false;
+	}
+	return total;
+}
+
+void HTTPFetcher::consume(int len)
+{
+	mReadOff = (mReadOff + len) % mBuffSize;
+	mNused -= len;
+	if (mNused == 0)
+	{
+		/* start over at the front, the next writes are less likely to wrap */
+		mReadOff = 0;
+	}
+	mBytesDone += len;
+
+	/*
+	 * curl_easy_pause() may call the write callback right away, which only
+	 * appends to the free part of the buffer.
+	 */
+	resumeIfRoom();
+}
+
+void HTTPFetcher::seek(int64_t target)
+{
+	int64_t buffered = position() + mNused;
+
+	if (target < buffered)
+	{
+		consume(target - position());
+		return;
+	}
+
+	mNused = 0;
+	mReadOff = 0;
+	mBytesDone = target - mOffset;
+
+	/*
+	 * A transfer that is to get there soon goes on, dropping the bytes on
+	 * the way, it costs less than a new request. The others are started
+	 * again, from target.
+	 */
+	if (mState == FETCHER_RUNNING)
+	{
+		if (target - buffered <= (int64_t)mBuffSize)
+		{
+			mSkip = target - buffered;
+			resumeIfRoom();
+		}
+		else
+		{
+			mState = FETCHER_FAILED;
+			LOG(DEBUG1, "download from %s (off %ld, len %d) is restarted at %ld",
+					mUrl, mOffset, mLen, target);
+		}
+	}
+}
+
+int HTTPFetcher::borrow(const char **data, bool *eof)
 {
 	int avail;
 
 retry:
-	avail = mNused - mReadOff;
+	avail = mNused;
 	if (avail > 0)
 	{
-		if (avail > bufflen)
+		if ((size_t)avail > mBuffSize - mReadOff)
 		{
-			avail = bufflen;
+			avail = mBuffSize - mReadOff;
 		}
-		memcpy(buff, mReadBuff + mReadOff, avail);
-		mReadOff += avail;
-		mBytesDone += avail;
+		*data = mReadBuff + mReadOff;
 		*eof = false;
 		return avail;
 	}
 
-	if (mPaused)
+	if (mPaused && mCurl)
 	{
-		LOG(DEBUG2, "unpaused %s", mUrl);
-		mPaused = false;
-		curl_easy_pause(mCurl, CURLPAUSE_CONT);
+		resumeIfRoom();
 		/*
 		 * curl_easy_pause() will typically call the write callback immediately,
 		 * so loop back to see if we have more data now.
@@ -45,13 +45,20 @@ public:
 	~HTTPFetcher();
 
 	/*
-	 * Starts a new HTTP fetch operation.
+	 * Starts a new HTTP fetch operation on the given easy handle, which is
+	 * added to the multi-handle.
 	 *
-	 * The HTTPFetcher is registered with the given ResourceOwner. Deleting the
-	 * ResourceOwner will abort the transfer, mark this HTTPFetcher as failed,
-	 * and release the curl handle.
+	 * The handle is only borrowed. Whoever drives the transfer takes it back
+	 * with release() once the transfer is over, so that the next fetcher
+	 * can reuse it and its connection.
 	 */
-	void start(CURLM *curl_mhandle);
+	void start(CURLM *curl_mhandle, CURL *curl);
+
+	/*
+	 * Detach the easy handle from the multi-handle and give it back to the
+	 * caller. Returns NULL if the fetcher does not hold one.
+	 */
+	CURL *release();
 
 	/*
 	 * Read up to bufflen bytes from the source. Will not block; if no data
@@ -59,6 +66,41 @@ public:
 	 */
 	int get(char *buff, int bufflen, bool *eof);
 
+	/*
+	 * Point data at the next bytes of the buffer without copying them, and
+	 * return how many there are in a row, at most up to the end of the ring.
+	 * Will not block, as get(). The bytes stay where they are until
+	 * consume() moves past them.
+	 */
+	int borrow(const char **data, bool *eof);
+
+	/*
+	 * Move past len bytes returned by borrow().
+	 */
+	void consume(int len);
+
+	/*
+	 * Where the next byte returned comes from in the object.
+	 */
+	int64_t position() {
+		return mOffset + mBytesDone;
+	}
+
+	/*
+	 * Where the range of the fetcher ends in the object, past its last byte.
+	 */
+	int64_t end() {
+		return mOffset + mLen;
+	}
+
+	/*
+	 * Go on from target, between position() and end(). Buffered data before
+	 * it is dropped, and a running transfer not far from it drops the bytes
+	 * up to it as they come. Otherwise the fetcher is marked as failed, to be
+	 * released and started again from target.
+	 */
+	void seek(int64_t target);
+
 	/*
 	 * Called by DownloadPipeline when curl_multi_perform() reports that the
 	 * transfer is completed.
@@ -98,36 +140,49 @@ private:
 	int64_t mOffset;
 	int mLen;
 
-	int64_t mBytesDone;		/* Returned this many bytes to caller (allows retrying from where we left) */
+	int64_t mBytesDone;		/* Returned or skipped this many bytes (allows retrying from where we left) */
+	int64_t mSkip;			/* incoming bytes to drop, up to where a seek went */
 
 	HeaderContent mHeaders;
 
-	/* TODO: a ring buffer would be more efficient */
+	/*
+	 * A ring: the unread data starts at mReadOff and wraps around the end
+	 * of the buffer, it is never moved. curl is only paused when a write
+	 * does not fit in the free space, and let go again once half of the
+	 * buffer is free, or all of it is read.
+	 */
 	char *mReadBuff;			/* buffer to read into */
 	size_t mBuffSize;		/* allocated size (at least CURL_MAX_WRITE_SIZE) */
-	size_t mNused;			/* amount of valid data in buffer */
-	size_t mReadOff;			/* how much of the valid data has been consumed */
+	size_t mNused;			/* amount of unread data in buffer */
+	size_t mReadOff;			/* where the unread data starts */
 
 	bool mEof;
 
 	/* TODO: Retry support */
 	int mNFailures;			/* how many times have we failed at connecting? */
 
+	/*
+	 * Release the CURL handle, if still held, and destroy it.
+	 */
 	void cleanup();
 
 	/*
-	 * Release resources, and mark the transfer as failed. It can be retried by
-	 * calling HTTPFetcher_start() again.
+	 * Mark the transfer as failed. The CURL handle is taken back with release(),
+	 * and the transfer can be retried by calling start() again.
 	 */
 	void fail();
 
 	/*
-	 * Mark the transfer as completed successfully. This releases the CURL handle and
-	 * other resources, except for the buffer. You may continue to read remaining unread
-	 * data with HTTPFetcher_get().
+	 * Mark the transfer as completed successfully. The CURL handle is taken back
+	 * with release(). You may continue to read remaining unread data with get().
 	 */
 	void done();
 
+	/*
+	 * Let curl go on writing if it was paused and there is room enough now.
+	 */
+	void resumeIfRoom();
+
 	/*
 	 * CURL callback that places incoming data in the buffer.
 	 */
@@ -0,0 +1,260 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PartBufferPool.h"
+#include "DateTime.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+
+#include <string.h>
+
+#include <vector>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * Idle buffers kept for reuse at most, the others are freed when given back.
+ */
+static const size_t MAX_IDLE_BUFFERS = 16;
+
+PartBufferPool::PartBufferPool(int64_t limit)
+					: mLimit(limit),
+					  mUsedBytes(0),
+					  mIdleBytes(0),
+					  mPeak(0),
+					  mAllocations(0),
+					  mReuses(0),
+					  mWaits(0),
+					  mRejections(0)
+{
+}
+
+PartBufferPool::~PartBufferPool()
+{
+	std::multimap<int64_t, char *>::iterator itr = mIdle.begin();
+	while (itr != mIdle.end())
+	{
+		delete [] itr->second;
+		itr++;
+	}
+	mIdle.clear();
+
+	/* lent buffers are all back by now, the writers are gone before the context */
+	std::map<char *, int64_t>::iterator litr = mLent.begin();
+	while (litr != mLent.end())
+	{
+		delete [] litr->first;
+		litr++;
+	}
+	mLent.clear();
+}
+
+bool PartBufferPool::fits(int64_t size, int64_t held)
+{
+	if (mLimit <= 0 || mUsedBytes - held + size <= mLimit)
+	{
+		return true;
+	}
+	return mUsedBytes == held;
+}
+
+char *PartBufferPool::acquire(int64_t size, int64_t *capacity, int waitMs)
+{
+	return lend(NULL, size, capacity, waitMs);
+}
+
+char *PartBufferPool::resize(char *buffer, int64_t used, int64_t size, int64_t *capacity, int waitMs)
+{
+	char *result = lend(buffer, size, capacity, waitMs);
+	memcpy(result, buffer, used);
+	delete [] buffer;
+	return result;
+}
+
+char *PartBufferPool::lend(char *old, int64_t size, int64_t *capacity, int waitMs)
+{
+	std::vector<char *> evicted;
+	char *buffer = NULL;
+	bool allocate = false;
+	int64_t held = 0;
+
+	{
+		unique_lock<mutex> lock(mMutex);
+		steady_clock::time_point deadline = steady_clock::now() + milliseconds(waitMs > 0 ? waitMs : 0);
+		bool waited = false;
+
+		if (old)
+		{
+			std::map<char *, int64_t>::iterator itr = mLent.find(old);
+			if (itr == mLent.end())
+			{
+				THROW(InvalidParameter, "buffer %p does not belong to the part buffer pool", old);
+			}
+			held = itr->second;
+		}
+
+		while (true)
+		{
+			/* an idle buffer fits if it does not waste more than half of itself */
+			std::multimap<int64_t, char *>::iterator itr = mIdle.lower_bound(size);
+			if (itr != mIdle.end() && itr->first / 2 <= size)
+			{
+				buffer = itr->second;
+				*capacity = itr->first;
+				mIdleBytes -= itr->first;
+				mIdle.erase(itr);
+				mReuses++;
+				break;
+			}
+
+			if (fits(size, held))
+			{
+				/* make room for the new buffer, the largest idle ones go first */
+				while (mLimit > 0 && !mIdle.empty() && mUsedBytes - held + mIdleBytes + size > mLimit)
+				{
+					std::multimap<int64_t, char *>::iterator last = --mIdle.end();
+					mIdleBytes -= last->first;
+					evicted.push_back(last->second);
+					mIdle.erase(last);
+				}
+				*capacity = size;
+				allocate = true;
+				mAllocations++;
+				break;
+			}
+
+			if (waitMs == 0 || (waited && waitMs > 0 && steady_clock::now() >= deadline))
+			{
+				mRejections++;
+				THROW(QingStorWouldBlock, "part buffers are exhausted, %lld of %lld bytes in use",
+						static_cast<long long>(mUsedBytes), static_cast<long long>(mLimit));
+			}
+
+			if (!waited)
+			{
+				mWaits++;
+				waited = true;
+			}
+			if (waitMs < 0)
+			{
+				mReleased.wait(lock);
+			}
+			else
+			{
+				mReleased.wait_until(lock, deadline);
+			}
+		}
+
+		/* count the bytes before allocating, so that concurrent requests see them */
+		mUsedBytes += *capacity - held;
+		if (mUsedBytes > mPeak)
+		{
+			mPeak = mUsedBytes;
+		}
+		if (old)
+		{
+			mLent.erase(old);
+		}
+		if (!allocate)
+		{
+			mLent[buffer] = *capacity;
+		}
+	}
+
+	for (size_t i = 0; i < evicted.size(); i++)
+	{
+		delete [] evicted[i];
+	}
+
+	if (allocate)
+	{
+		try {
+			buffer = new char[*capacity];
+		} catch (...)
+		{
+			{
+				lock_guard<mutex> lock(mMutex);
+				mUsedBytes -= *capacity - held;
+				if (old)
+				{
+					mLent[old] = held;
+				}
+			}
+			mReleased.notify_all();
+			throw;
+		}
+		lock_guard<mutex> lock(mMutex);
+		mLent[buffer] = *capacity;
+	}
+
+	return buffer;
+}
+
+void PartBufferPool::release(char *buffer)
+{
+	if (!buffer)
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		std::map<char *, int64_t>::iterator itr = mLent.find(buffer);
+		if (itr == mLent.end())
+		{
+			THROW(InvalidParameter, "buffer %p does not belong to the part buffer pool", buffer);
+		}
+		int64_t size = itr->second;
+		mLent.erase(itr);
+		mUsedBytes -= size;
+
+		if (mIdle.size() < MAX_IDLE_BUFFERS)
+		{
+			mIdle.insert(std::make_pair(size, buffer));
+			mIdleBytes += size;
+			buffer = NULL;
+		}
+	}
+
+	mReleased.notify_all();
+	delete [] buffer;
+}
+
+PartBufferPoolStats PartBufferPool::stats()
+{
+	lock_guard<mutex> lock(mMutex);
+	PartBufferPoolStats result;
+	result.limit = mLimit;
+	result.used = mUsedBytes;
+	result.idle = mIdleBytes;
+	result.peak = mPeak;
+	result.buffers = static_cast<int32_t>(mLent.size());
+	result.allocations = mAllocations;
+	result.reuses = mReuses;
+	result.waits = mWaits;
+	result.rejections = mRejections;
+	return result;
+}
+
+}
+}
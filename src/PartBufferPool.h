@@ -0,0 +1,123 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_PARTBUFFERPOOL_H_
+#define __QINGSTOR_LIBQINGSTOR_PARTBUFFERPOOL_H_
+
+#include "Thread.h"
+
+#include <stdint.h>
+
+#include <map>
+
+namespace QingStor {
+namespace Internal {
+
+class PartBufferPoolStats {
+public:
+	int64_t limit;			/* most bytes the pool hands out, 0 is no cap */
+	int64_t used;			/* bytes of the buffers lent to writers */
+	int64_t idle;			/* bytes of the buffers kept for reuse */
+	int64_t peak;			/* highest used so far */
+	int32_t buffers;		/* buffers lent to writers */
+	int64_t allocations;	/* buffers that had to be allocated */
+	int64_t reuses;			/* buffers served from the idle ones */
+	int64_t waits;			/* requests that had to wait for memory */
+	int64_t rejections;		/* requests given up for lack of memory */
+};
+
+/*
+ * The part buffers of all the writers of a Context.
+ *
+ * A writer borrows a buffer when it has data to put in it and gives it back
+ * once the part is acknowledged, so the memory a context spends on buffering
+ * follows the data actually in flight rather than the number of open
+ * objects. The bytes lent out are capped; a writer asking for more waits
+ * until other parts are over, or is turned down. The pool is thread safe.
+ *
+ * Buffers given back are kept for reuse, up to a few of them. Idle buffers
+ * count against the cap and are freed first when memory runs short.
+ */
+class PartBufferPool {
+public:
+	PartBufferPool(int64_t limit);
+
+	~PartBufferPool();
+
+	/*
+	 * Borrow a buffer of at least size bytes, its actual size is stored in
+	 * capacity. If the cap is reached, wait up to waitMs ms for memory to be
+	 * given back, forever if waitMs is negative, then throw QingStorWouldBlock.
+	 * A buffer larger than the cap is granted when nothing else is lent out.
+	 */
+	char *acquire(int64_t size, int64_t *capacity, int waitMs);
+
+	/*
+	 * Trade a buffer got by acquire() for one of at least size bytes holding
+	 * its first used bytes, waiting as acquire() does. The bytes of the old
+	 * buffer count as given back, so a buffer larger than the cap is granted
+	 * when nothing else is lent out. On failure the old buffer is kept.
+	 *
+	 * Growing a buffer by doubling copies each byte once on average: the
+	 * copies of all the steps add up to less than the final size.
+	 */
+	char *resize(char *buffer, int64_t used, int64_t size, int64_t *capacity, int waitMs);
+
+	/*
+	 * Give back a buffer got by acquire().
+	 */
+	void release(char *buffer);
+
+	PartBufferPoolStats stats();
+
+private:
+	mutex mMutex;
+	condition_variable mReleased;
+
+	int64_t mLimit;
+	std::map<char *, int64_t> mLent;			/* size by buffer */
+	std::multimap<int64_t, char *> mIdle;		/* buffers by size */
+	int64_t mUsedBytes;
+	int64_t mIdleBytes;
+
+	int64_t mPeak;
+	int64_t mAllocations;
+	int64_t mReuses;
+	int64_t mWaits;
+	int64_t mRejections;
+
+	/*
+	 * Whether size more bytes may be lent out, once idle buffers are freed and
+	 * the held bytes of a buffer traded in are given back.
+	 */
+	bool fits(int64_t size, int64_t held);
+
+	/*
+	 * Lend a buffer of at least size bytes in exchange for old, if not NULL.
+	 */
+	char *lend(char *old, int64_t size, int64_t *capacity, int waitMs);
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_PARTBUFFERPOOL_H_ */
@@ -0,0 +1,154 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PartStream.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+
+#include <string.h>
+
+namespace QingStor {
+namespace Internal {
+
+PartStream::PartStream(shared_ptr<PartBufferPool> pool, int64_t capacity, int waitMs)
+						: mPool(pool),
+						  mBuffer(NULL),
+						  mCapacity(0),
+						  mHead(0),
+						  mSize(0),
+						  mRead(0),
+						  mFinished(false),
+						  mAborted(false)
+{
+	mBuffer = mPool->acquire(capacity, &mCapacity, waitMs);
+}
+
+PartStream::~PartStream()
+{
+	mPool->release(mBuffer);
+}
+
+int64_t PartStream::write(const char *data, int64_t length)
+{
+	lock_guard<mutex> lock(mMutex);
+	if (mAborted || mFinished)
+	{
+		THROW(QingStorIOException, "writing to a part stream that is over");
+	}
+
+	int64_t copied = 0;
+	while (copied < length && mSize < mCapacity)
+	{
+		int64_t tail = (mHead + mSize) % mCapacity;
+		/* up to the end of the ring, or to the head if the free space wraps */
+		int64_t room = tail >= mHead ? mCapacity - tail : mHead - tail;
+		if (room > mCapacity - mSize)
+		{
+			room = mCapacity - mSize;
+		}
+		int64_t n = length - copied < room ? length - copied : room;
+		memcpy(mBuffer + tail, data + copied, n);
+		mSize += n;
+		copied += n;
+	}
+	return copied;
+}
+
+bool PartStream::waitForRoom()
+{
+	unique_lock<mutex> lock(mMutex);
+	while (mSize == mCapacity && !mAborted)
+	{
+		mRoom.wait(lock);
+	}
+	return !mAborted;
+}
+
+void PartStream::finish()
+{
+	lock_guard<mutex> lock(mMutex);
+	mFinished = true;
+}
+
+void PartStream::abort()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mAborted = true;
+	}
+	mRoom.notify_all();
+}
+
+size_t PartStream::read(char *buffer, size_t length)
+{
+	size_t copied = 0;
+	{
+		lock_guard<mutex> lock(mMutex);
+		while (copied < length && mSize > 0)
+		{
+			int64_t chunk = mCapacity - mHead < mSize ? mCapacity - mHead : mSize;
+			size_t n = length - copied < static_cast<size_t>(chunk) ? length - copied : chunk;
+			memcpy(buffer + copied, mBuffer + mHead, n);
+			mHead = (mHead + n) % mCapacity;
+			mSize -= n;
+			mRead += n;
+			copied += n;
+		}
+	}
+	if (copied > 0)
+	{
+		mRoom.notify_all();
+	}
+	return copied;
+}
+
+bool PartStream::readable()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mSize > 0 || mFinished || mAborted;
+}
+
+bool PartStream::finished()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mFinished && mSize == 0;
+}
+
+bool PartStream::aborted()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mAborted;
+}
+
+const char *PartStream::contents(int64_t *length)
+{
+	lock_guard<mutex> lock(mMutex);
+	if (mRead > 0)
+	{
+		THROW(QingStorIOException, "part stream was read from already");
+	}
+	*length = mSize;
+	return mBuffer;
+}
+
+}
+}
@@ -0,0 +1,119 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_PARTSTREAM_H_
+#define __QINGSTOR_LIBQINGSTOR_PARTSTREAM_H_
+
+#include "Memory.h"
+#include "PartBufferPool.h"
+#include "Thread.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * A bounded ring between a writer and the transfer of the part it is
+ * writing, so that the part goes out while it is written and the writer
+ * only holds the ring rather than the whole part.
+ *
+ * The writer appends and finishes the stream, the upload engine reads from
+ * it in the curl read callback. The ring is borrowed from the part buffer
+ * pool and given back when the last of them drops the stream.
+ */
+class PartStream {
+public:
+	/*
+	 * Borrow a ring of capacity bytes from the pool, waiting waitMs ms for
+	 * it as acquire() of the pool does.
+	 */
+	PartStream(shared_ptr<PartBufferPool> pool, int64_t capacity, int waitMs);
+
+	~PartStream();
+
+	/*
+	 * Copy as much of data as there is room for, without blocking. Return
+	 * the bytes copied.
+	 */
+	int64_t write(const char *data, int64_t length);
+
+	/*
+	 * Block until there is room to write. Return false if the stream was
+	 * aborted, i.e. the transfer is over.
+	 */
+	bool waitForRoom();
+
+	/*
+	 * No more data is coming.
+	 */
+	void finish();
+
+	/*
+	 * Give up the stream, from either side: the writer stops waiting for
+	 * room and the transfer fails.
+	 */
+	void abort();
+
+	/*
+	 * Take up to length bytes, without blocking. Return 0 when there is
+	 * nothing to read yet, or any more.
+	 */
+	size_t read(char *buffer, size_t length);
+
+	/*
+	 * Whether the reader can make progress: there is data, or the stream is
+	 * finished or aborted.
+	 */
+	bool readable();
+
+	/*
+	 * Whether all the data was written and read.
+	 */
+	bool finished();
+
+	bool aborted();
+
+	/*
+	 * The data written so far, as long as none of it was read.
+	 */
+	const char *contents(int64_t *length);
+
+private:
+	mutex mMutex;
+	condition_variable mRoom;
+
+	shared_ptr<PartBufferPool> mPool;
+	char *mBuffer;
+	int64_t mCapacity;
+	int64_t mHead;			/* where the next read starts */
+	int64_t mSize;			/* bytes in the ring */
+	int64_t mRead;			/* bytes read so far */
+	bool mFinished;
+	bool mAborted;
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_PARTSTREAM_H_ */
@@ -26,7 +26,10 @@
 
 
 #include "Context.h"
+#include "DateTime.h"
+#include "Function.h"
 #include "Memory.h"
+#include "Thread.h"
 #include "Exception.h"
 #include "ExceptionInternal.h"
 #include "Logger.h"
@@ -37,6 +40,7 @@
 #include <string.h>
 
 #include <string>
+#include <vector>
 
 #ifdef __cplusplus
 extern "C" {
@@ -77,6 +81,17 @@ using QingStor::Internal::ObjectInfo;
 using QingStor::Internal::RangeInfo;
 using QingStor::Internal::QingStorReader;
 using QingStor::Internal::QingStorWriter;
+using QingStor::Internal::UploadToken;
+using QingStor::Internal::ConnectionPoolStats;
+using QingStor::Internal::PartBufferPoolStats;
+using QingStor::Internal::UploadStats;
+using QingStor::Internal::SpoolStatus;
+using QingStor::Internal::mutex;
+using QingStor::Internal::lock_guard;
+using QingStor::Internal::unique_lock;
+using QingStor::Internal::condition_variable;
+using QingStor::Internal::steady_clock;
+using QingStor::Internal::milliseconds;
 
 struct QingStorObjectInternalWrapper {
 public:
@@ -138,6 +153,127 @@ private:
 	void *rw;
 };
 
+/*
+ * The outcome of a close run in the background, shared by the task and the
+ * handle the caller waits on.
+ */
+struct AsyncClose {
+public:
+	AsyncClose() : done(false) {
+
+	}
+
+	void finish(QingStor::exception_ptr e) {
+		lock_guard<mutex> lock(mtx);
+		error = e;
+		done = true;
+		cond.notify_all();
+	}
+
+	/*
+	 * Wait up to waitMs ms, forever if negative. Return false on timeout.
+	 */
+	bool wait(int waitMs) {
+		unique_lock<mutex> lock(mtx);
+		steady_clock::time_point deadline = steady_clock::now() + milliseconds(waitMs > 0 ? waitMs : 0);
+		while (!done)
+		{
+			if (waitMs == 0 || (waitMs > 0 && steady_clock::now() >= deadline))
+			{
+				return false;
+			}
+			if (waitMs < 0)
+			{
+				cond.wait(lock);
+			}
+			else
+			{
+				cond.wait_for(lock, deadline - steady_clock::now());
+			}
+		}
+		return true;
+	}
+
+	QingStor::exception_ptr getError() {
+		lock_guard<mutex> lock(mtx);
+		return error;
+	}
+
+private:
+	mutex mtx;
+	condition_variable cond;
+	bool done;
+	QingStor::exception_ptr error;
+};
+
+/*
+ * Closes an object on the close worker of its context. A task dropped with
+ * the worker, before it could run, fails its close.
+ */
+struct AsyncCloseTask {
+public:
+	AsyncCloseTask(shared_ptr<AsyncClose> state) :
+		object(NULL), state(state) {
+
+	}
+
+	/*
+	 * The task closes and frees the object from now on.
+	 */
+	void adopt(QingStorObjectInternalWrapper *object) {
+		this->object = object;
+	}
+
+	/*
+	 * Give the object back, for a task that could not be queued.
+	 */
+	void disown() {
+		object = NULL;
+	}
+
+	~AsyncCloseTask() {
+		if (object) {
+			delete object;
+			try {
+				THROW(QingStor::QingStorIOException, "the context was destroyed before the object was closed");
+			} catch (...) {
+				state->finish(QingStor::current_exception());
+			}
+		}
+	}
+
+	void run() {
+		QingStor::exception_ptr error;
+		try {
+			object->getWriter().close();
+		} catch (...) {
+			error = QingStor::current_exception();
+		}
+		/* the writer lets go of its resources before the caller hears of it */
+		delete object;
+		object = NULL;
+		state->finish(error);
+	}
+
+private:
+	QingStorObjectInternalWrapper *object;
+	shared_ptr<AsyncClose> state;
+};
+
+struct QingStorCloseHandleInternalWrapper {
+public:
+	QingStorCloseHandleInternalWrapper(shared_ptr<AsyncClose> state) : state(state) {
+
+	}
+
+	AsyncClose & getState() {
+		return *state;
+	}
+
+private:
+	shared_ptr<AsyncClose> state;
+};
+
 struct QingStorContextInternalWrapper {
 public:
 	QingStorContextInternalWrapper(Context *ctx) : context(ctx) {
@@ -169,6 +305,8 @@ static void handleException(QingStor::exception_ptr error) {
         errno = EACCES;
     } catch (const QingStor::QingStorCanceled &) {
         errno = EIO;
+    } catch (const QingStor::QingStorWouldBlock &) {
+        errno = EAGAIN;
     } catch (const QingStor::QingStorConfigInvalid &) {
         errno = EINVAL;
     } catch (const QingStor::QingStorConfigNotFound &) {
@@ -204,7 +342,7 @@ qingstorContext qingstorInitContext(const char *location, const char *access_key
 	PARAMETER_ASSERT(access_key_id != NULL && strlen(access_key_id) > 0, NULL, EINVAL);
 	PARAMETER_ASSERT(secret_access_key != NULL && strlen(secret_access_key) > 0, NULL, EINVAL);
 
-	Context *context;
+	Context *context = NULL;
 	try {
 		std::string str_access_key_id(access_key_id);
 		std::string str_secret_access_key(secret_access_key);
@@ -228,7 +366,7 @@ qingstorContext qingstorInitContext(const char *location, const char *access_key
 qingstorContext qingstorInitContextFromFile(const char *config_file) {
 	PARAMETER_ASSERT(config_file != NULL && strlen(config_file) > 0, NULL, EINVAL);
 
-	Context *context;
+	Context *context = NULL;
 	try {
 		std::string str_config_file(config_file);
 		context = new Context(str_config_file);
@@ -412,7 +550,7 @@ qingstorObject qingstorGetObject(qingstorContext context, const char *bucket,
 			range_end = (range_end < 0) ? res->content_length - 1 : range_end;
 			RangeInfo range = {range_start, range_end};
 			ObjectInfo object = {str_key, res->content_length, range};
-			QingStorReader *reader = new QingStorReader(context->getContext().configuration(), str_bucket, object);
+			QingStorReader *reader = new QingStorReader(&context->getContext(), str_bucket, object);
 			result->setReader(true);
 			result->setRW((void *) reader);
 			return result;
@@ -430,27 +568,175 @@ qingstorObject qingstorGetObject(qingstorContext context, const char *bucket,
 
 qingstorObject qingstorPutObject(qingstorContext context, const char *bucket,
 								const char *key, bool cache)
+{
+	return qingstorPutObjectWithSize(context, bucket, key, cache, -1);
+}
+
+qingstorObject qingstorPutObjectWithSize(qingstorContext context, const char *bucket,
+								const char *key, bool cache, int64_t expected_size)
+{
+	PARAMETER_ASSERT(context, NULL, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, NULL, EINVAL);
+	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, NULL, EINVAL);
+
+	QingStorObjectInternalWrapper *result = NULL;
+	try {
+		result = new QingStorObjectInternalWrapper();
+		std::string str_bucket(bucket);
+		std::string str_key(key);
+
+		ObjectInfo object = {str_key, expected_size};
+		QingStorWriter *writer = new QingStorWriter(&context->getContext(), str_bucket, object, cache);
+		result->setReader(false);
+		result->setRW((void *) writer);
+		return result;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return NULL;
+}
+
+qingstorObject qingstorResumePutObject(qingstorContext context, const char *bucket,
+								const char *key, const char *journal, int64_t *offset)
+{
+	PARAMETER_ASSERT(context, NULL, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, NULL, EINVAL);
+	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, NULL, EINVAL);
+	PARAMETER_ASSERT(journal != NULL && strlen(journal) > 0, NULL, EINVAL);
+	PARAMETER_ASSERT(offset, NULL, EINVAL);
+
+	QingStorObjectInternalWrapper *result = NULL;
+	QingStorWriter *writer = NULL;
+	try {
+		result = new QingStorObjectInternalWrapper();
+		std::string str_bucket(bucket);
+		std::string str_key(key);
+
+		ObjectInfo object = {str_key, -1};
+		writer = new QingStorWriter(&context->getContext(), str_bucket, object, true, journal);
+		*offset = writer->resume();
+		result->setReader(false);
+		result->setRW((void *) writer);
+		return result;
+	} catch (const std::bad_alloc & e)
+	{
+		delete writer;
+		delete result;
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		delete writer;
+		delete result;
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return NULL;
+}
+
+int qingstorPutObjectFromFile(qingstorContext context, const char *bucket,
+								const char *key, int fd)
+{
+	PARAMETER_ASSERT(context, -1, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, -1, EINVAL);
+	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, -1, EINVAL);
+	PARAMETER_ASSERT(fd >= 0, -1, EINVAL);
+
+	QingStorWriter *writer = NULL;
+	try {
+		std::string str_bucket(bucket);
+		std::string str_key(key);
+
+		ObjectInfo object = {str_key, -1};
+		writer = new QingStorWriter(&context->getContext(), str_bucket, object, true);
+		writer->putFile(fd);
+		delete writer;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		delete writer;
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		delete writer;
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+qingstorObject qingstorPutObjectParts(qingstorContext context, const char *bucket,
+								const char *key)
+{
+	PARAMETER_ASSERT(context, NULL, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, NULL, EINVAL);
+	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, NULL, EINVAL);
+
+	QingStorObjectInternalWrapper *result = NULL;
+	QingStorWriter *writer = NULL;
+	try {
+		result = new QingStorObjectInternalWrapper();
+		std::string str_bucket(bucket);
+		std::string str_key(key);
+
+		ObjectInfo object = {str_key, -1};
+		writer = new QingStorWriter(&context->getContext(), str_bucket, object, true);
+		writer->openParts();
+		result->setReader(false);
+		result->setRW((void *) writer);
+		return result;
+	} catch (const std::bad_alloc & e)
+	{
+		delete writer;
+		delete result;
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		delete writer;
+		delete result;
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return NULL;
+}
+
+qingstorObject qingstorPutObjectSpooled(qingstorContext context, const char *bucket,
+								const char *key)
 {
 	PARAMETER_ASSERT(context, NULL, EINVAL);
 	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, NULL, EINVAL);
 	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, NULL, EINVAL);
 
 	QingStorObjectInternalWrapper *result = NULL;
+	QingStorWriter *writer = NULL;
 	try {
 		result = new QingStorObjectInternalWrapper();
 		std::string str_bucket(bucket);
 		std::string str_key(key);
 
-		ObjectInfo object = {str_key, 0};
-		QingStorWriter *writer = new QingStorWriter(context->getContext().configuration(), str_bucket, object, cache);
+		ObjectInfo object = {str_key, -1};
+		writer = new QingStorWriter(&context->getContext(), str_bucket, object, true);
+		writer->spool();
 		result->setReader(false);
 		result->setRW((void *) writer);
 		return result;
 	} catch (const std::bad_alloc & e)
 	{
+		delete writer;
+		delete result;
 		SetErrorMessage("Out of memory");
 		errno = ENOMEM;
 	} catch (...) {
+		delete writer;
+		delete result;
 		SetLastException(QingStor::current_exception());
 		handleException(QingStor::current_exception());
 	}
@@ -458,6 +744,53 @@ qingstorObject qingstorPutObject(qingstorContext context, const char *bucket,
 	return NULL;
 }
 
+int qingstorFlushSpool(qingstorContext context, int timeout_ms)
+{
+	PARAMETER_ASSERT(context, -1, EINVAL);
+	PARAMETER_ASSERT(context->getContext().spoolUploader(), -1, EINVAL);
+
+	try {
+		context->getContext().spoolUploader()->flush(timeout_ms);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorGetSpoolStatus(qingstorContext context, qingstorSpoolStatus *stats)
+{
+	PARAMETER_ASSERT(context && stats, -1, EINVAL);
+	PARAMETER_ASSERT(context->getContext().spoolUploader(), -1, EINVAL);
+
+	try {
+		SpoolStatus res = context->getContext().spoolUploader()->status();
+		stats->limit = res.limit;
+		stats->spooled = res.spooled;
+		stats->pending = res.pending;
+		stats->pendingBytes = res.pendingBytes;
+		stats->uploaded = res.uploaded;
+		stats->uploadedBytes = res.uploadedBytes;
+		stats->failed = res.failed;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
 qingstorHeadObjectResult* qingstorHeadObject(qingstorContext context, const char *bucket,
 								const char *key)
 {
@@ -594,14 +927,474 @@ int32_t qingstorRead(qingstorContext context, qingstorObject object, void *buffe
 	return -1;
 }
 
-int32_t qingstorWrite(qingstorContext context, qingstorObject object, const void *buffer, int32_t length)
+int qingstorReadBorrow(qingstorContext context, qingstorObject object, const void **data,
+								int32_t *length)
+{
+	PARAMETER_ASSERT(context && object && data && length, -1, EINVAL);
+	PARAMETER_ASSERT(object->isReader(), -1, EINVAL);
+
+	try {
+		const char *borrowed = NULL;
+		*length = object->getReader().borrowData(&borrowed);
+		*data = borrowed;
+		return 0;
+	} catch (const QingStor::QingStorEndOfStream & e)
+	{
+		*data = NULL;
+		*length = 0;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorReadRelease(qingstorContext context, qingstorObject object, int32_t length)
+{
+	PARAMETER_ASSERT(context && object && length >= 0, -1, EINVAL);
+	PARAMETER_ASSERT(object->isReader(), -1, EINVAL);
+
+	try {
+		object->getReader().releaseData(length);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int32_t qingstorPread(qingstorContext context, qingstorObject object, int64_t offset, void *buffer,
+						int32_t length)
 {
 	PARAMETER_ASSERT(context && object && buffer && length > 0, -1, EINVAL);
-	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+	PARAMETER_ASSERT(object->isReader(), -1, EINVAL);
 
 	try {
-		object->getWriter().transferData(static_cast<const char *>(buffer), length);
-		return length;
+		return object->getReader().pread(offset, static_cast<char *>(buffer), length);
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorReadv(qingstorContext context, const char *bucket, const char *key,
+								const qingstorRange *ranges, void **buffers, int n)
+{
+	PARAMETER_ASSERT(context, -1, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, -1, EINVAL);
+	PARAMETER_ASSERT(key != NULL && strlen(key) > 0, -1, EINVAL);
+	PARAMETER_ASSERT(n >= 0 && (n == 0 || (ranges && buffers)), -1, EINVAL);
+
+	try {
+		std::string str_bucket(bucket);
+		std::string str_key(key);
+		std::vector<RangeInfo> infos;
+
+		for (int i = 0; i < n; i++)
+		{
+			PARAMETER_ASSERT(ranges[i].offset >= 0 && ranges[i].length >= 0, -1, EINVAL);
+			PARAMETER_ASSERT(ranges[i].length == 0 || buffers[i], -1, EINVAL);
+			RangeInfo range = {ranges[i].offset, ranges[i].offset + ranges[i].length - 1};
+			infos.push_back(range);
+		}
+
+		shared_ptr<HeadObjectResult> res = context->getContext().headObject(str_bucket, str_key);
+		RangeInfo whole = {0, res->content_length - 1};
+		ObjectInfo object = {str_key, res->content_length, whole};
+		QingStorReader::readRanges(&context->getContext(), str_bucket, object, infos,
+								reinterpret_cast<char **>(buffers));
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorSeek(qingstorContext context, qingstorObject object, int64_t offset)
+{
+	PARAMETER_ASSERT(context && object && offset >= 0, -1, EINVAL);
+	PARAMETER_ASSERT(object->isReader(), -1, EINVAL);
+
+	try {
+		object->getReader().seek(offset);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int64_t qingstorTell(qingstorContext context, qingstorObject object)
+{
+	PARAMETER_ASSERT(context && object, -1, EINVAL);
+	PARAMETER_ASSERT(object->isReader(), -1, EINVAL);
+
+	return object->getReader().tell();
+}
+
+int32_t qingstorWrite(qingstorContext context, qingstorObject object, const void *buffer, int32_t length)
+{
+	PARAMETER_ASSERT(context && object && buffer && length > 0, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		return object->getWriter().transferData(static_cast<const char *>(buffer), length);
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int32_t qingstorWriteDonate(qingstorContext context, qingstorObject object, void *buffer, int32_t length,
+								qingstorFreeFunc free_fn, void *arg)
+{
+	PARAMETER_ASSERT(context && object && buffer && length > 0 && free_fn, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		object->getWriter().donateData(static_cast<char *>(buffer), length, free_fn, arg);
+		return length;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+qingstorCloseHandle qingstorCloseObjectAsync(qingstorContext context, qingstorObject object)
+{
+	PARAMETER_ASSERT(context && object, NULL, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), NULL, EINVAL);
+
+	QingStorCloseHandleInternalWrapper *handle = NULL;
+	shared_ptr<AsyncCloseTask> task;
+	try {
+		shared_ptr<AsyncClose> state(new AsyncClose());
+		task = shared_ptr<AsyncCloseTask>(new AsyncCloseTask(state));
+		handle = new QingStorCloseHandleInternalWrapper(state);
+
+		/* the object is the task's once queued, until then it is the caller's */
+		task->adopt(object);
+		if (!context->getContext().closeWorker()->submit(QingStor::bind(&AsyncCloseTask::run, task)))
+		{
+			THROW(QingStor::QingStorIOException, "the context is being destroyed");
+		}
+		return handle;
+	} catch (const std::bad_alloc & e)
+	{
+		if (task)
+		{
+			task->disown();
+		}
+		delete handle;
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		if (task)
+		{
+			task->disown();
+		}
+		delete handle;
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return NULL;
+}
+
+int qingstorWaitClose(qingstorContext context, qingstorCloseHandle handle, int timeout_ms)
+{
+	PARAMETER_ASSERT(context && handle, -1, EINVAL);
+
+	try {
+		if (!handle->getState().wait(timeout_ms))
+		{
+			SetErrorMessage("the object is still being closed");
+			errno = EAGAIN;
+			return -1;
+		}
+		QingStor::exception_ptr error = handle->getState().getError();
+		delete handle;
+		if (error)
+		{
+			QingStor::rethrow_exception(error);
+		}
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorWritePart(qingstorContext context, qingstorObject object, int32_t part_number,
+								const void *buffer, int32_t length)
+{
+	PARAMETER_ASSERT(context && object && buffer && length > 0, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		object->getWriter().writePart(part_number, static_cast<const char *>(buffer), length);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int32_t qingstorExportUploadToken(qingstorContext context, qingstorObject object,
+								int32_t first_part, int32_t last_part, char *token, int32_t size)
+{
+	PARAMETER_ASSERT(context && object && token && size > 0, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		std::string text = object->getWriter().exportToken(first_part, last_part).serialize();
+		if (static_cast<int32_t>(text.length()) >= size)
+		{
+			SetErrorMessage("token buffer too small");
+			errno = ERANGE;
+			return -1;
+		}
+		memcpy(token, text.c_str(), text.length() + 1);
+		return static_cast<int32_t>(text.length());
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+qingstorObject qingstorPutObjectFromToken(qingstorContext context, const char *token)
+{
+	PARAMETER_ASSERT(context && token, NULL, EINVAL);
+
+	QingStorObjectInternalWrapper *result = NULL;
+	QingStorWriter *writer = NULL;
+	try {
+		result = new QingStorObjectInternalWrapper();
+		UploadToken upload = UploadToken::parse(token);
+
+		ObjectInfo object = {upload.key, -1};
+		writer = new QingStorWriter(&context->getContext(), upload.bucket, object, true);
+		writer->joinUpload(upload);
+		result->setReader(false);
+		result->setRW((void *) writer);
+		return result;
+	} catch (const std::bad_alloc & e)
+	{
+		delete writer;
+		delete result;
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		delete writer;
+		delete result;
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return NULL;
+}
+
+int qingstorGetPartETag(qingstorContext context, qingstorObject object, int32_t part_number,
+								char *etag, int32_t size)
+{
+	PARAMETER_ASSERT(context && object && etag && size > 0, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		std::string value = object->getWriter().partETag(part_number);
+		if (value.empty())
+		{
+			SetErrorMessage("part was not written");
+			errno = ENOENT;
+			return -1;
+		}
+		if (static_cast<int32_t>(value.length()) >= size)
+		{
+			SetErrorMessage("ETag buffer too small");
+			errno = ERANGE;
+			return -1;
+		}
+		memcpy(etag, value.c_str(), value.length() + 1);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorAddPart(qingstorContext context, qingstorObject object, int32_t part_number,
+								const char *etag)
+{
+	PARAMETER_ASSERT(context && object && etag, -1, EINVAL);
+	PARAMETER_ASSERT(!object->isReader(), -1, EINVAL);
+
+	try {
+		object->getWriter().addPart(part_number, etag);
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorGetConnectionPoolStats(qingstorContext context, qingstorConnectionPoolStats *stats)
+{
+	PARAMETER_ASSERT(context && stats, -1, EINVAL);
+
+	try {
+		ConnectionPoolStats res = context->getContext().connectionPool()->stats();
+		stats->hits = res.hits;
+		stats->misses = res.misses;
+		stats->discards = res.discards;
+		stats->idle = res.idle;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorGetPartBufferPoolStats(qingstorContext context, qingstorPartBufferPoolStats *stats)
+{
+	PARAMETER_ASSERT(context && stats, -1, EINVAL);
+
+	try {
+		PartBufferPoolStats res = context->getContext().partBufferPool()->stats();
+		stats->limit = res.limit;
+		stats->used = res.used;
+		stats->idle = res.idle;
+		stats->peak = res.peak;
+		stats->buffers = res.buffers;
+		stats->allocations = res.allocations;
+		stats->reuses = res.reuses;
+		stats->waits = res.waits;
+		stats->rejections = res.rejections;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorGetUploadStats(qingstorContext context, qingstorUploadStats *stats)
+{
+	PARAMETER_ASSERT(context && stats, -1, EINVAL);
+
+	try {
+		UploadStats res = context->getContext().uploadEngine()->stats();
+		stats->parts = res.parts;
+		stats->retries = res.retries;
+		stats->failures = res.failures;
+		stats->digests = res.digests;
+		stats->digestBytes = res.digestBytes;
+		stats->digestMicros = res.digestMicros;
+		stats->inlineDigestMicros = res.inlineDigestMicros;
+		stats->etagMismatches = res.etagMismatches;
+		return 0;
+	} catch (const std::bad_alloc & e)
+	{
+		SetErrorMessage("Out of memory");
+		errno = ENOMEM;
+	} catch (...) {
+		SetLastException(QingStor::current_exception());
+		handleException(QingStor::current_exception());
+	}
+
+	return -1;
+}
+
+int qingstorPrewarm(qingstorContext context, const char *bucket, int n)
+{
+	PARAMETER_ASSERT(context, -1, EINVAL);
+	PARAMETER_ASSERT(bucket != NULL && strlen(bucket) > 0, -1, EINVAL);
+
+	try {
+		context->getContext().prewarm(bucket, n);
+		return 0;
 	} catch (const std::bad_alloc & e)
 	{
 		SetErrorMessage("Out of memory");
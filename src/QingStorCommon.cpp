@@ -26,9 +26,15 @@
 #include "Exception.h"
 #include "ExceptionInternal.h"
 #include "Logger.h"
+#include "DateTime.h"
+#include "Thread.h"
 
 #include "lib/encode.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
 #include <sstream>
 
 namespace QingStor {
@@ -38,7 +44,8 @@ void
 Signature(HeaderContent *h, const char *path_with_query,
 			const QSCredential *cred,
 			QSRequestType qsrt,
-			MemoryData *md)
+			MemoryData *md,
+			const char *content_md5)
 {
 	char timebuf[65];
 	char tmpbuf[33];		/* SHA_DIGEST_LENGTH is 20 */
@@ -50,11 +57,15 @@ Signature(HeaderContent *h, const char *path_with_query,
 	if (QSRT_LIST_OBJECT == qsrt || QSRT_INIT_MP_UPLOAD == qsrt ||
 			QSRT_GET_DATA == qsrt || QSRT_LIST_BUCKET == qsrt ||
 			QSRT_HEAD_OBJECT == qsrt || QSRT_DELETE_OBJECT == qsrt ||
-			QSRT_ABORT_MP_UPLOAD == qsrt)
+			QSRT_ABORT_MP_UPLOAD == qsrt || QSRT_LIST_MP == qsrt)
 	{
 		HeaderContent_Add(h, CONTENTLENGTH, "0");
 	}
-	else if (QSRT_UPLOAD_MP == qsrt || QSRT_COMP_MP_UPLOAD == qsrt)
+	else if ((QSRT_UPLOAD_MP == qsrt || QSRT_PUT_OBJECT == qsrt) && !md)
+	{
+		HeaderContent_Add(h, TRANSFERENCODING, "chunked");
+	}
+	else if (QSRT_UPLOAD_MP == qsrt || QSRT_COMP_MP_UPLOAD == qsrt || QSRT_PUT_OBJECT == qsrt)
 	{
 		std::stringstream tsstr;
 		tsstr<<md->sizeleft;
@@ -67,7 +78,8 @@ Signature(HeaderContent *h, const char *path_with_query,
 	strftime(timebuf, 64, "%a, %d %b %Y %H:%M:%S GMT", tm_info);
 	HeaderContent_Add(h, DATE, timebuf);
 
-	if (QSRT_LIST_OBJECT == qsrt || QSRT_GET_DATA == qsrt || QSRT_LIST_BUCKET == qsrt)
+	if (QSRT_LIST_OBJECT == qsrt || QSRT_GET_DATA == qsrt || QSRT_LIST_BUCKET == qsrt ||
+			QSRT_LIST_MP == qsrt)
 	{
 		sstr<<"GET\n\n\n"<<timebuf<<"\n"<<path_with_query;
 	}
@@ -88,10 +100,15 @@ Signature(HeaderContent *h, const char *path_with_query,
 	{
 		sstr<<"PUT\n\n\n"<<timebuf<<"\n"<<path_with_query;
 	}
-	else if (QSRT_UPLOAD_MP == qsrt)
+	else if (QSRT_UPLOAD_MP == qsrt || QSRT_PUT_OBJECT == qsrt)
 	{
-		HeaderContent_Add(h, CONTENTTYPE, "plain/text");
-		sstr<<"PUT\n\n"<<"plain/text"<<"\n"<<timebuf<<"\n"<<path_with_query;
+		const char *content_type = QSRT_UPLOAD_MP == qsrt ? "plain/text" : "application/octet-stream";
+		HeaderContent_Add(h, CONTENTTYPE, content_type);
+		if (content_md5)
+		{
+			HeaderContent_Add(h, CONTENTMD5, content_md5);
+		}
+		sstr<<"PUT\n"<<(content_md5 ? content_md5 : "")<<"\n"<<content_type<<"\n"<<timebuf<<"\n"<<path_with_query;
 	}
 	else
 	{
@@ -139,6 +156,8 @@ std::string GetFieldString(HeaderField f)
 		return std::string("Authorization");
 	case ETAG:
 		return std::string("ETag");
+	case TRANSFERENCODING:
+		return std::string("Transfer-Encoding");
 	default:
 		return std::string("unknown");
 	}
@@ -216,22 +235,83 @@ mem_read_callback(void *ptr, size_t size, size_t nmemb, void *userp)
 	return n2read;
 }
 
+/*
+ * The body of a request as it was before curl started to read it, so that
+ * curl can go back in it when it has to send it again, on a redirect or a
+ * connection that was closed under it.
+ */
+typedef struct {
+	MemoryData *md;
+	MemoryData origin;
+} MemorySeekData;
+
+static int
+mem_seek_callback(void *userp, curl_off_t offset, int origin)
+{
+	MemorySeekData *seek = (MemorySeekData *)userp;
+
+	if (origin != SEEK_SET)
+	{
+		return CURL_SEEKFUNC_CANTSEEK;
+	}
+	if (offset < 0 || (size_t)offset > seek->origin.sizeleft)
+	{
+		return CURL_SEEKFUNC_FAIL;
+	}
+	seek->md->advance = seek->origin.advance + offset;
+	seek->md->sizeleft = seek->origin.sizeleft - offset;
+
+	return CURL_SEEKFUNC_OK;
+}
+
+int
+RetryBackoff(int failures)
+{
+	int backoff = RETRY_BACKOFF_MS;
+
+	for (int i = 1; i < failures && backoff < MAX_RETRY_BACKOFF_MS; i++)
+	{
+		backoff <<= 1;
+	}
+	backoff = backoff < MAX_RETRY_BACKOFF_MS ? backoff : MAX_RETRY_BACKOFF_MS;
+
+	return backoff / 2 + rand() % (backoff / 2 + 1);
+}
+
 json_object*
 DoGetJSON(const char *host, const char *url, const char *bucket,
 			const char *location,
 			const QSCredential *cred,
 			QSRequestType qsrt,
-			MemoryData *md, int retries)
+			MemoryData *md, int retries,
+			ConnectionPool *pool,
+			const char *content_md5)
 {
 	struct json_object *result = NULL;
 	int failing = 0;
+	MemoryData body;
+
+	/*
+	 * a failed attempt may have consumed some of the body, every attempt
+	 * sends it from the start.
+	 */
+	if (md)
+	{
+		body = *md;
+	}
 
 retry:
 	try {
-		result = DoGetJSON_Internal(host, url, bucket, location, cred, qsrt, md);
+		result = DoGetJSON_Internal(host, url, bucket, location, cred, qsrt, md, pool, content_md5);
 	} catch (...) {
 		if(++failing < retries) {
-			LOG(WARNING, "qingstor request type %d is failed, retrying", qsrt);
+			int backoff = RetryBackoff(failing);
+			LOG(WARNING, "qingstor request type %d is failed, retrying in %d ms", qsrt, backoff);
+			sleep_for(milliseconds(backoff));
+			if (md)
+			{
+				*md = body;
+			}
  			goto retry;
 		} else {
 			LOG(LOG_ERROR, "qingstor request type %d is failed after retried %d times", qsrt, retries);
@@ -246,25 +326,41 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 			const char *location,
 			const QSCredential *cred,
 			QSRequestType qsrt,
-			MemoryData *md)
+			MemoryData *md,
+			ConnectionPool *pool,
+			const char *content_md5)
 {
-	CURL *curl;
+	CURL *curl = NULL;
+	struct curl_slist *chunk = NULL;
+	HeaderContent *header = NULL;
 	char *path;
 	char *query;
 	volatile BufferInfo jsonInfo;
 	volatile BufferInfo yamlInfo;
 	struct json_object *result = NULL;
+	MemorySeekData seek;
 	jsonInfo.data = NULL;
 	yamlInfo.data = NULL;
 
 	try {
-		curl = curl_easy_init();
-		if (!curl)
+		if (pool)
+		{
+			/*
+			 * a pooled handle keeps its connection alive for the next request
+			 * to the same host.
+			 */
+			curl = pool->acquire(host);
+		}
+		else
 		{
-			THROW(OutOfMemoryException, "cound not create curl instance");
+			curl = curl_easy_init();
+			if (!curl)
+			{
+				THROW(OutOfMemoryException, "cound not create curl instance");
+			}
+			curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
 		}
 		curl_easy_setopt(curl, CURLOPT_URL, url);
-		curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
 		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&jsonInfo);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ParserCallback);
 		if (QSRT_HEAD_OBJECT == qsrt)
@@ -283,11 +379,16 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 		}
 		if (QSRT_INIT_MP_UPLOAD == qsrt)
 		{
+			/*
+			 * "uploads" is carried by the query string, the body must match
+			 * the "Content-Length: 0" we sign, or the leftover bytes would be
+			 * read as the start of the next request on a kept-alive connection.
+			 */
 			curl_easy_setopt(curl, CURLOPT_POST, 1L);
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "uploads");
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen("uploads"));
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+			curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
 		}
-		if (QSRT_UPLOAD_MP == qsrt || QSRT_COMP_MP_UPLOAD == qsrt)
+		if (QSRT_UPLOAD_MP == qsrt || QSRT_COMP_MP_UPLOAD == qsrt || QSRT_PUT_OBJECT == qsrt)
 		{
 			/*
 			 * now specify which file/data to upload
@@ -303,12 +404,20 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 			 */
 			curl_easy_setopt(curl, CURLOPT_READFUNCTION, mem_read_callback);
 
+			/*
+			 * and let curl rewind it when it has to send it again
+			 */
+			seek.md = md;
+			seek.origin = *md;
+			curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)&seek);
+			curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, mem_seek_callback);
+
 			/*
 			 * provide the size of the upload
 			 */
 			curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)md->sizeleft);
 
-			if (QSRT_UPLOAD_MP == qsrt)
+			if (QSRT_UPLOAD_MP == qsrt || QSRT_PUT_OBJECT == qsrt)
 			{
 				/*
 				 * enable uploading
@@ -328,7 +437,7 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 				curl_easy_setopt(curl, CURLOPT_POST, 1L);
 			}
 		}
-		HeaderContent *header = new HeaderContent;
+		header = new HeaderContent;
 		HeaderContent_Add(header, HOST, host);
 		if (location != NULL)
 		{
@@ -351,7 +460,7 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 		{
 			sstr<<"/"<<bucket<<path;
 		}
-		Signature(header, sstr.str().c_str(), cred, qsrt, md);
+		Signature(header, sstr.str().c_str(), cred, qsrt, md, content_md5);
 		if (path)
 		{
 			delete path;
@@ -361,7 +470,7 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 			delete query;
 		}
 
-		struct curl_slist *chunk = HeaderContent_GetList(header);
+		chunk = HeaderContent_GetList(header);
 		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
 
 		CURLcode res = curl_easy_perform(curl);
@@ -373,7 +482,19 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 		}
 		else
 		{
-			if (QSRT_LIST_OBJECT == qsrt || QSRT_INIT_MP_UPLOAD == qsrt || QSRT_LIST_BUCKET == qsrt)
+			/*
+			 * a server error may carry no body at all, it must not pass for
+			 * a success or the request would never be sent again.
+			 */
+			long code = 0;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+			if (code >= 500)
+			{
+				THROW(QingStorNetworkException, "HTTP request failed with status %ld with qsrt as %d",
+						code, qsrt);
+			}
+			if (QSRT_LIST_OBJECT == qsrt || QSRT_INIT_MP_UPLOAD == qsrt || QSRT_LIST_BUCKET == qsrt ||
+					QSRT_LIST_MP == qsrt)
 			{
 				if (!jsonInfo.data)
 				{
@@ -419,10 +540,40 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 			}
 		}
 		curl_slist_free_all(chunk);
-		curl_easy_cleanup(curl);
+		if (pool)
+		{
+			pool->release(host, curl);
+		}
+		else
+		{
+			curl_easy_cleanup(curl);
+		}
 		delete header;
 	} catch(const QingStorException & e)
 	{
+		if (chunk)
+		{
+			curl_slist_free_all(chunk);
+		}
+		if (curl)
+		{
+			/*
+			 * the connection may be left in an unknown state, never
+			 * hand it out again.
+			 */
+			if (pool)
+			{
+				pool->release(host, curl, false);
+			}
+			else
+			{
+				curl_easy_cleanup(curl);
+			}
+		}
+		if (header)
+		{
+			delete header;
+		}
 		if (jsonInfo.data)
 		{
 			delete jsonInfo.data;
@@ -439,6 +590,237 @@ DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 	return result;
 }
 
+/*
+ * Where the body of a ranged GET goes. A server that ignores the range sends
+ * the whole object with 200, the bytes before the range are skipped then.
+ */
+typedef struct {
+	CURL *curl;
+	int64_t offset;
+	char *buff;
+	int32_t length;
+	int32_t position;
+	int64_t skip;				/* -1 until the response code is known */
+	bool discard;				/* the body is an error document */
+	bool unsized;				/* the whole object came for a suffix, of unknown length */
+} RangeData;
+
+static size_t
+range_write_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	RangeData *range = (RangeData *)userp;
+	size_t realsize = size * nmemb;
+	const char *data = (const char *)contents;
+	size_t n;
+
+	if (range->skip < 0)
+	{
+		long code = 0;
+		curl_off_t total = -1;
+
+		range->skip = 0;
+		curl_easy_getinfo(range->curl, CURLINFO_RESPONSE_CODE, &code);
+		if (code == 200)
+		{
+			curl_easy_getinfo(range->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &total);
+			if (range->offset >= 0)
+			{
+				range->skip = range->offset;
+			}
+			else if (total < 0)
+			{
+				/*
+				 * Where the tail starts is not known before the end, and
+				 * the head must not pass for it.
+				 */
+				range->unsized = true;
+				return 0;
+			}
+			else if (total > -range->offset)
+			{
+				range->skip = total + range->offset;
+			}
+		}
+		else if (code != 206)
+		{
+			range->discard = true;
+		}
+	}
+	if (range->discard)
+	{
+		return realsize;
+	}
+
+	if (range->skip > 0)
+	{
+		n = realsize < (size_t)range->skip ? realsize : range->skip;
+		range->skip -= n;
+		data += n;
+		realsize -= n;
+		if (!realsize)
+		{
+			return size * nmemb;
+		}
+	}
+
+	n = range->length - range->position;
+	if (!n)
+	{
+		/* all that was asked for is there, the rest is not wanted */
+		return 0;
+	}
+	n = realsize < n ? realsize : n;
+	memcpy(range->buff + range->position, data, n);
+	range->position += n;
+
+	return size * nmemb;
+}
+
+static int32_t
+DoGetRange_Internal(const char *host, const char *url, const char *bucket,
+					const QSCredential *cred, int64_t offset,
+					char *buff, int32_t length, ConnectionPool *pool)
+{
+	CURL *curl = NULL;
+	struct curl_slist *chunk = NULL;
+	HeaderContent header;
+	char *path;
+	char *query;
+	char rangebuf[128];
+	RangeData range;
+	std::stringstream sstr;
+
+	try {
+		curl = pool->acquire(host);
+		range.curl = curl;
+		range.offset = offset;
+		range.buff = buff;
+		range.length = length;
+		range.position = 0;
+		range.skip = -1;
+		range.discard = false;
+		range.unsized = false;
+
+		curl_easy_setopt(curl, CURLOPT_URL, url);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&range);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, range_write_callback);
+
+		HeaderContent_Add(&header, HOST, host);
+		if (offset >= 0)
+		{
+			snprintf(rangebuf, sizeof(rangebuf), "bytes=%" PRId64 "-%" PRId64, offset, offset + length - 1);
+		}
+		else
+		{
+			snprintf(rangebuf, sizeof(rangebuf), "bytes=%" PRId64, offset);
+		}
+		HeaderContent_Add(&header, RANGE, rangebuf);
+
+		qs_parse_url(url,
+					NULL /* schema */,
+					NULL /* host */,
+					&path,
+					&query,
+					NULL /* fullurl */);
+		if (query)
+		{
+			sstr<<"/"<<bucket<<path<<"?"<<query;
+		}
+		else
+		{
+			sstr<<"/"<<bucket<<path;
+		}
+		Signature(&header, sstr.str().c_str(), cred, QSRT_GET_DATA, NULL);
+		if (path)
+		{
+			delete path;
+		}
+		if (query)
+		{
+			delete query;
+		}
+
+		chunk = HeaderContent_GetList(&header);
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
+
+		CURLcode res = curl_easy_perform(curl);
+		bool complete = (res == CURLE_WRITE_ERROR && range.position == length);
+
+		if (range.unsized)
+		{
+			THROW(QingStorIOException, "ranged GET of %s got the whole object without its length, "
+					"its last %" PRId64 " bytes are not known", url, -offset);
+		}
+		if (CURLE_OK != res && !complete)
+		{
+			THROW(QingStorNetworkConnectException, "curl_easy_perform() failed: %s",
+					curl_easy_strerror(res));
+		}
+
+		long code = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		if (code >= 500)
+		{
+			THROW(QingStorNetworkException, "ranged GET of %s failed with status %ld", url, code);
+		}
+		if (code == 416)
+		{
+			/* the range starts past the end of the object */
+			range.position = 0;
+		}
+		else if (code == 403)
+		{
+			THROW(AccessControlException, "ranged GET of %s is denied", url);
+		}
+		else if (code != 200 && code != 206)
+		{
+			THROW(QingStorIOException, "ranged GET of %s failed with status %ld", url, code);
+		}
+
+		curl_slist_free_all(chunk);
+		/* a transfer cut short leaves the connection with bytes to read */
+		pool->release(host, curl, !complete);
+	} catch (const QingStorException & e)
+	{
+		if (chunk)
+		{
+			curl_slist_free_all(chunk);
+		}
+		if (curl)
+		{
+			pool->release(host, curl, false);
+		}
+		throw;
+	}
+
+	return range.position;
+}
+
+int32_t
+DoGetRange(const char *host, const char *url, const char *bucket,
+			const QSCredential *cred, int64_t offset,
+			char *buff, int32_t length, int retries,
+			ConnectionPool *pool)
+{
+	int failing = 0;
+
+	for (;;)
+	{
+		try {
+			return DoGetRange_Internal(host, url, bucket, cred, offset, buff, length, pool);
+		} catch (const QingStorNetworkException & e) {
+			if (++failing >= retries)
+			{
+				LOG(LOG_ERROR, "ranged GET of %s failed after retried %d times", url, retries);
+				throw;
+			}
+			int backoff = RetryBackoff(failing);
+			LOG(WARNING, "ranged GET of %s failed, retrying in %d ms", url, backoff);
+			sleep_for(milliseconds(backoff));
+		}
+	}
+}
+
 static char *
 extract_field(const char *url, const struct http_parser_url *u,
 				enum http_parser_url_fields i)
@@ -549,6 +931,28 @@ qs_parse_url(const char *url, char **schema, char **host, char **path,
 	}
 }
 
+/*
+ * HTTP/2 sends header names in lower case, turn them into the form we look
+ * up, e.g. "content-length" into "Content-Length".
+ */
+static std::string
+CanonicalHeaderName(const std::string &name)
+{
+	std::string result = name;
+	bool upper = true;
+
+	if (strcasecmp(name.c_str(), "ETag") == 0)
+	{
+		return std::string("ETag");
+	}
+	for (size_t i = 0; i < result.length(); i++)
+	{
+		result[i] = upper ? toupper(result[i]) : tolower(result[i]);
+		upper = (result[i] == '-');
+	}
+	return result;
+}
+
 json_object* ParseHttpHeader(const char *content)
 {
 	std::stringstream sstr(content);
@@ -560,7 +964,7 @@ json_object* ParseHttpHeader(const char *content)
 		std::size_t pos;
 		if ((pos = str.find(":")) != std::string::npos)
 		{
-			std::string key = str.substr(0, pos);
+			std::string key = CanonicalHeaderName(str.substr(0, pos));
 			if (pos + 2 >= str.length())
 				return NULL;
 			std::string value = str.substr(pos + 2);
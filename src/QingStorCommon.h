@@ -27,6 +27,7 @@
 #include <json/json.h>
 
 #include "lib/http_parser.h"
+#include "ConnectionPool.h"
 
 #include <list>
 #include <string>
@@ -50,6 +51,7 @@ typedef enum {
 	EXPECT,
 	AUTHORIZATION,
 	ETAG,
+	TRANSFERENCODING,
 } HeaderField;
 
 typedef struct {
@@ -74,7 +76,9 @@ typedef enum {
 	QSRT_INIT_MP_UPLOAD,
 	QSRT_UPLOAD_MP,
 	QSRT_ABORT_MP_UPLOAD,
-	QSRT_COMP_MP_UPLOAD
+	QSRT_COMP_MP_UPLOAD,
+	QSRT_PUT_OBJECT,
+	QSRT_LIST_MP
 } QSRequestType;
 
 typedef struct {
@@ -82,29 +86,69 @@ typedef struct {
 	size_t sizeleft;
 } MemoryData;
 
+/*
+ * A failed request is sent again after RetryBackoff() ms, which doubles
+ * from RETRY_BACKOFF_MS with every failure up to MAX_RETRY_BACKOFF_MS.
+ */
+#define RETRY_BACKOFF_MS 200
+#define MAX_RETRY_BACKOFF_MS 10000
+
 typedef size_t (*MemReadCallback)(void *ptr, size_t size, size_t nmemb, void *userp);
 
 extern bool HeaderContent_Add(HeaderContent *h, HeaderField f, const char *value);
 
 extern struct curl_slist *HeaderContent_GetList(HeaderContent *h);
 
+/*
+ * content_md5, the base64 MD5 of the body, is sent and signed when given.
+ * An upload without md has a body of unknown length, sent chunked.
+ */
 extern void Signature(HeaderContent *h, const char *path_with_query,
 					const QSCredential *cred,
 					QSRequestType qsrt,
-					MemoryData *md);
+					MemoryData *md,
+					const char *content_md5 = NULL);
 
+/*
+ * How long to wait before a request that failed failures times is sent
+ * again, with some jitter so that requests that failed together do not all
+ * come back at once.
+ */
+extern int RetryBackoff(int failures);
+
+/*
+ * Send a request, up to retries times if it fails. The body in md is sent
+ * from where it starts on every attempt, it has to stay there until this
+ * returns.
+ */
 extern json_object*
 DoGetJSON(const char *host, const char *url, const char *bucket,
 			const char *location,
 			const QSCredential *cred,
 			QSRequestType qsrt,
-			MemoryData *md, int retries = 1);
+			MemoryData *md, int retries = 1,
+			ConnectionPool *pool = NULL,
+			const char *content_md5 = NULL);
 
 extern json_object* DoGetJSON_Internal(const char *host, const char *url, const char *bucket,
 							const char *location,
 							const QSCredential *cred,
 							QSRequestType qsrt,
-							MemoryData *md);
+							MemoryData *md,
+							ConnectionPool *pool = NULL,
+							const char *content_md5 = NULL);
+
+/*
+ * Get up to length bytes of an object into buff with a single ranged GET:
+ * from offset on, or with offset below 0 from -offset bytes before the end
+ * of the object, whatever its size. Return how many bytes were got, fewer
+ * than length only at the end of the object. The request is sent again, up
+ * to retries times in all, when the connection or the server fails.
+ */
+extern int32_t DoGetRange(const char *host, const char *url, const char *bucket,
+						const QSCredential *cred, int64_t offset,
+						char *buff, int32_t length, int retries,
+						ConnectionPool *pool);
 
 extern std::string GetFieldString(HeaderField f);
 
@@ -25,9 +25,10 @@
 namespace QingStor {
 namespace Internal {
 
-QingStorRWBase::QingStorRWBase(shared_ptr<Configuration> configuration,
+QingStorRWBase::QingStorRWBase(Context *context,
 								std::string bucket, ObjectInfo object)
-				: mConfiguration(configuration),
+				: mContext(context),
+				  mConfiguration(context->configuration()),
 				  mBucket(bucket),
 				  mObject(object)
 {
@@ -38,9 +38,10 @@ namespace Internal {
  */
 class QingStorRWBase {
 public:
-	QingStorRWBase(shared_ptr<Configuration> configuration, std::string bucket, ObjectInfo object);
+	QingStorRWBase(Context *context, std::string bucket, ObjectInfo object);
 
 protected:
+	Context *mContext;			/* the context the object is opened in, outlives the object */
 	shared_ptr<Configuration> mConfiguration;
 	std::string mBucket;
 	ObjectInfo mObject;
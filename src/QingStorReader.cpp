@@ -26,14 +26,15 @@
 #include "ExceptionInternal.h"
 #include "Logger.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace QingStor {
 namespace Internal {
 
-QingStorReader::QingStorReader(shared_ptr<Configuration> configuration, std::string bucket,
+QingStorReader::QingStorReader(Context *context, std::string bucket,
 							ObjectInfo object)
-							: QingStorRWBase(configuration, bucket, object)
+							: QingStorRWBase(context, bucket, object)
 {
 	std::list<shared_ptr<ObjectInfo> > objects;
 	shared_ptr<ObjectInfo> obj (new ObjectInfo());
@@ -42,9 +43,133 @@ QingStorReader::QingStorReader(shared_ptr<Configuration> configuration, std::str
 	obj->range = object.range;
 	objects.push_back(obj);
 
+	mPosition = object.range.start;
 	setupPipeline(objects);
 }
 
+QingStorReader::QingStorReader(Context *context, std::string bucket, ObjectInfo object,
+							std::list<shared_ptr<ObjectInfo> > segments)
+							: QingStorRWBase(context, bucket, object)
+{
+	mPosition = object.range.start;
+	setupPipeline(segments);
+}
+
+/*
+ * Orders the ranges of a vectored read by where they start.
+ */
+class RangeStartLess {
+public:
+	RangeStartLess(const std::vector<RangeInfo> &ranges) : mRanges(ranges) {
+	}
+
+	bool operator()(size_t a, size_t b) const {
+		return mRanges[a].start < mRanges[b].start;
+	}
+
+private:
+	const std::vector<RangeInfo> &mRanges;
+};
+
+void QingStorReader::readRanges(Context *context, std::string bucket, ObjectInfo object,
+							const std::vector<RangeInfo> &ranges, char **buffers)
+{
+	std::vector<size_t> order;
+	std::list<shared_ptr<ObjectInfo> > segments;
+	int64_t gap = context->configuration()->mReadvGap;
+
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		if (ranges[i].start < 0 || ranges[i].end > object.size - 1)
+		{
+			THROW(InvalidParameter, "range %ld-%ld is out of the object %s of %ld bytes",
+					ranges[i].start, ranges[i].end, object.key.c_str(), object.size);
+		}
+		if (ranges[i].end >= ranges[i].start)
+		{
+			order.push_back(i);
+		}
+	}
+	if (order.empty())
+	{
+		return;
+	}
+	std::sort(order.begin(), order.end(), RangeStartLess(ranges));
+
+	/*
+	 * Coalesce the ranges into segments: the bytes between ranges close
+	 * enough cost less to get and drop than a request of their own.
+	 */
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const RangeInfo &range = ranges[order[i]];
+		if (segments.empty() || range.start > segments.back()->range.end + 1 + gap)
+		{
+			shared_ptr<ObjectInfo> segment(new ObjectInfo());
+			segment->key = object.key;
+			segment->size = object.size;
+			segment->range = range;
+			segments.push_back(segment);
+		}
+		else if (range.end > segments.back()->range.end)
+		{
+			segments.back()->range.end = range.end;
+		}
+	}
+
+	LOG(DEBUG1, "%zu ranges of %s are read with %zu GETs", order.size(), object.key.c_str(), segments.size());
+
+	object.range.start = segments.front()->range.start;
+	object.range.end = segments.back()->range.end;
+	QingStorReader reader(context, bucket, object, segments);
+
+	/*
+	 * Scatter the data of the segments, as it comes, into the ranges it
+	 * falls in.
+	 */
+	std::list<shared_ptr<ObjectInfo> >::iterator segment = segments.begin();
+	int64_t pos = (*segment)->range.start;
+	size_t first = 0;		/* the ranges before are filled */
+	while (segment != segments.end())
+	{
+		const char *data;
+		int64_t len;
+
+		try {
+			len = reader.borrowData(&data);
+		} catch (const QingStorEndOfStream & e) {
+			THROW(QingStorIOException, "object %s ended at %ld before the ranges read were", object.key.c_str(), pos);
+		}
+		len = std::min(len, (*segment)->range.end - pos + 1);
+
+		while (first < order.size() && ranges[order[first]].end < pos)
+		{
+			first++;
+		}
+		for (size_t i = first; i < order.size() && ranges[order[i]].start < pos + len; i++)
+		{
+			const RangeInfo &range = ranges[order[i]];
+			int64_t from = std::max(range.start, pos);
+			int64_t to = std::min(range.end, pos + len - 1);
+			if (from <= to)
+			{
+				memcpy(buffers[order[i]] + (from - range.start), data + (from - pos), to - from + 1);
+			}
+		}
+
+		reader.releaseData(len);
+		pos += len;
+		if (pos > (*segment)->range.end)
+		{
+			segment++;
+			if (segment != segments.end())
+			{
+				pos = (*segment)->range.start;
+			}
+		}
+	}
+}
+
 int QingStorReader::transferData(char *buff, int buffsize)
 {
 	bool eof = false;
@@ -53,15 +178,55 @@ int QingStorReader::transferData(char *buff, int buffsize)
 	{
 		THROW(QingStorEndOfStream,"transferData");
 	}
+	mPosition += rnum;
 	return rnum;
 }
 
+void QingStorReader::seek(int64_t offset)
+{
+	if (offset < mObject.range.start || offset > mObject.range.end + 1)
+	{
+		THROW(InvalidParameter, "offset %ld is out of the range %ld-%ld the object is read in",
+				offset, mObject.range.start, mObject.range.end);
+	}
+	if (!mPipeline->seek(offset) && offset <= mObject.range.end)
+	{
+		addFetchers(mObject.key, offset, mObject.range.end);
+	}
+	mPosition = offset;
+}
+
+int32_t QingStorReader::pread(int64_t offset, char *buff, int32_t length)
+{
+	std::stringstream sstr;
+
+	sstr<<mConfiguration->mProtocol<<"://"<<mHost<<"/"<<mObject.key;
+	QSCredential cred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
+
+	return DoGetRange(mHost.c_str(), sstr.str().c_str(), mBucket.c_str(), &cred, offset,
+					buff, length, mConfiguration->mConnectionRetries, mContext->connectionPool().get());
+}
+
+int QingStorReader::borrowData(const char **data)
+{
+	bool eof = false;
+	int rnum = mPipeline->borrow(data, &eof);
+	if (eof)
+	{
+		THROW(QingStorEndOfStream, "borrowData");
+	}
+	return rnum;
+}
+
+void QingStorReader::releaseData(int len)
+{
+	mPipeline->consume(len);
+	mPosition += len;
+}
+
 void QingStorReader::setupPipeline(std::list<shared_ptr<ObjectInfo> > objects)
 {
 	std::stringstream sstr;
-	std::string host;
-	int64_t chunkSize;
-	int buffSize;
 
 	/*
 	 * If we're going to use multiple connections, divide the file into
@@ -73,70 +238,74 @@ void QingStorReader::setupPipeline(std::list<shared_ptr<ObjectInfo> > objects)
 	 */
 	if (mConfiguration->mNConnections > 1)
 	{
-		chunkSize = mConfiguration->mChunkSize;
-		if (chunkSize > 128 * 1024 * 1024)
+		mChunkSize = mConfiguration->mChunkSize;
+		if (mChunkSize > 128 * 1024 * 1024)
 		{
-			buffSize = 128 * 1024 * 1024;
+			mBuffSize = 128 * 1024 * 1024;
 		}
 		else
 		{
-			buffSize = chunkSize;
+			mBuffSize = mChunkSize;
 		}
 	}
 	else
 	{
-		chunkSize = -1;
-		buffSize = -1;
+		mChunkSize = -1;
+		mBuffSize = -1;
 	}
 
 	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
-	host = sstr.str();
-	sstr.str("");
-	sstr.clear();
+	mHost = sstr.str();
 
 	/*
 	 * Create a pipeline that will download all the contents.
 	 */
-	mPipeline = shared_ptr<DownloadPipeline> (new DownloadPipeline(mConfiguration->mNConnections));
+	mPipeline = shared_ptr<DownloadPipeline> (new DownloadPipeline(mConfiguration->mNConnections,
+												mContext->connectionPool(), mContext->transferScheduler(), mHost));
 	std::list<shared_ptr<ObjectInfo> >::iterator itr = objects.begin();
 	while (itr != objects.end())
 	{
 		shared_ptr<ObjectInfo> object = *itr;
 		itr++;
-		shared_ptr<HTTPFetcher> fetcher;
-		int64_t offset;
-		int64_t len;
-
-		sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<object->key;
 
-		LOG(DEBUG1, "key: %s, size: %ld, range: %ld-%ld", sstr.str().c_str(), object->size, object->range.start, object->range.end);
+		LOG(DEBUG1, "key: %s, size: %ld, range: %ld-%ld", object->key.c_str(), object->size, object->range.start, object->range.end);
 
-		/*
-		 * Divide the file into chunks of requested size.
-		 */
-		offset = object->range.start;
-		do {
-			if (chunkSize == -1 || offset + chunkSize > object->range.end)
-			{
-				/* last chunk */
-				len = object->range.end - offset + 1;
-			}
-			else
-			{
-				len = chunkSize;
-			}
-			QSCredential cred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
-			fetcher = shared_ptr<HTTPFetcher> (new HTTPFetcher(sstr.str().c_str(), host.c_str(), mBucket.c_str(),
-										&cred, buffSize, offset, len));
-			mPipeline->add(fetcher);
-			offset += len;
-		} while (offset <= object->range.end);
-
-		sstr.str("");
-		sstr.clear();
+		addFetchers(object->key, object->range.start, object->range.end);
 	}
 }
 
+void QingStorReader::addFetchers(const std::string &key, int64_t start, int64_t end)
+{
+	std::stringstream sstr;
+	shared_ptr<HTTPFetcher> fetcher;
+	int64_t offset;
+	int64_t len;
+
+	sstr<<mConfiguration->mProtocol<<"://"<<mHost<<"/"<<key;
+
+	/*
+	 * Divide the file into chunks of requested size.
+	 */
+	offset = start;
+	do {
+		if (mChunkSize == -1 || offset + mChunkSize > end)
+		{
+			/* last chunk */
+			len = end - offset + 1;
+		}
+		else
+		{
+			len = mChunkSize;
+		}
+		QSCredential cred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
+		/* a chunk short of the buffer size does not need all of it */
+		fetcher = shared_ptr<HTTPFetcher> (new HTTPFetcher(sstr.str().c_str(), mHost.c_str(), mBucket.c_str(),
+									&cred, (mBuffSize > 0 && len < mBuffSize) ? (int)len : mBuffSize, offset, len));
+		mPipeline->add(fetcher);
+		offset += len;
+	} while (offset <= end);
+}
+
 void QingStorReader::close()
 {
 	return;
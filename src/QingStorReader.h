@@ -28,6 +28,7 @@
 #include "Memory.h"
 
 #include <list>
+#include <vector>
 
 namespace QingStor {
 namespace Internal {
@@ -36,14 +37,69 @@ class ObjectInfo;
 
 class QingStorReader : public QingStorRWBase {
 public:
-	QingStorReader(shared_ptr<Configuration> configuration, std::string bucket, ObjectInfo object);
+	QingStorReader(Context *context, std::string bucket, ObjectInfo object);
+
+	/*
+	 * Read the given ranges of an object, in any order and possibly
+	 * overlapping, ranges[i] into buffers[i]. They have to lie within the
+	 * object. Ranges less than readv_gap bytes apart are got with a single
+	 * GET, and the GETs are split in chunks and run num_connections at a time
+	 * as for a reader of the whole object.
+	 */
+	static void readRanges(Context *context, std::string bucket, ObjectInfo object,
+				const std::vector<RangeInfo> &ranges, char **buffers);
 
 	int transferData(char *buff, int buffsize);
 
+	/*
+	 * Point data at the next bytes of the object, in the buffer they were
+	 * received into, and return how many there are. They stay valid until
+	 * releaseData() or transferData(). Throws QingStorEndOfStream at the end.
+	 */
+	int borrowData(const char **data);
+
+	/*
+	 * Move past len bytes returned by borrowData(), the ones after are
+	 * returned again by the next call.
+	 */
+	void releaseData(int len);
+
+	/*
+	 * Go on reading from offset in the object, within the range the reader
+	 * was opened on, or right past its end. The data prefetched from offset
+	 * on is kept.
+	 */
+	void seek(int64_t offset);
+
+	/*
+	 * Get up to length bytes of the object from offset, or with offset below
+	 * 0 from -offset bytes before its end, with a request of its own. The
+	 * position and the data prefetched are left alone. Return how many bytes
+	 * were got, 0 past the end of the object.
+	 */
+	int32_t pread(int64_t offset, char *buff, int32_t length);
+
+	/*
+	 * Where the next byte read comes from in the object.
+	 */
+	int64_t tell() {
+		return mPosition;
+	}
+
 	void close();
 
 private:
+	/*
+	 * A reader of the given segments of the object only, one after the other.
+	 */
+	QingStorReader(Context *context, std::string bucket, ObjectInfo object,
+				std::list<shared_ptr<ObjectInfo> > segments);
+
 	shared_ptr<DownloadPipeline> mPipeline;
+	std::string mHost;
+	int64_t mChunkSize;			/* of the fetchers, -1 for one over the whole range */
+	int mBuffSize;				/* of a fetcher, -1 for the default */
+	int64_t mPosition;
 
 	/*
 	 * Form a download pipeline that will fetch all objects listed in the given
@@ -51,6 +107,12 @@ private:
 	 */
 	void setupPipeline(std::list<shared_ptr<ObjectInfo> > objects);
 
+	/*
+	 * Add the fetchers of the range from start to end of an object, both
+	 * included, to the pipeline.
+	 */
+	void addFetchers(const std::string &key, int64_t start, int64_t end);
+
 };
 
 }
@@ -24,115 +24,1214 @@
 #include "QingStorCommon.h"
 #include "Exception.h"
 #include "ExceptionInternal.h"
+#include "DateTime.h"
+#include "Logger.h"
+#include "lib/encode.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <sstream>
+#include <vector>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * QingStor wants the parts but the last one to be at least this large.
+ */
+static const int64_t MIN_PART_SIZE = 4 * 1024 * 1024;
+
+/*
+ * The service takes up to 5GB in a part, we stay below 2GB so that a part
+ * length fits in an int32_t.
+ */
+static const int64_t MAX_PART_SIZE = 1024 * 1024 * 1024;
+
+/*
+ * Most parts a multipart upload can have.
+ */
+static const int32_t MAX_PARTS = 10000;
+
+static const int32_t PARTS_PER_GROWTH = 1000;
+
+/*
+ * The buffer of the first part starts this large, most objects written by
+ * many writers at once are small.
+ */
+static const int64_t INITIAL_BUFFER_SIZE = 64 * 1024;
+
+static const char *TOKEN_MAGIC = "qingstor-upload-token 1";
+
+static once_flag WholePartsOnce;
+static once_flag ChunkedPartsOnce;
+
+static void LogWholeParts()
+{
+	LOG(INFO, "stream_buffer_size is not used with a journal or enable_content_md5, parts are buffered whole");
+}
+
+static void LogChunkedParts()
+{
+	LOG(INFO, "no part buffer memory to keep a copy of a streamed part, sending parts of unknown size chunked");
+}
+
+std::string UploadToken::serialize() const
+{
+	std::stringstream sstr;
+	sstr<<TOKEN_MAGIC<<"\n";
+	sstr<<"bucket "<<bucket<<"\n";
+	sstr<<"upload_id "<<uploadId<<"\n";
+	sstr<<"parts "<<firstPart<<" "<<lastPart<<"\n";
+	/* last, the key may hold anything but a newline */
+	sstr<<"key "<<key<<"\n";
+	return sstr.str();
+}
+
+UploadToken UploadToken::parse(const std::string &text)
+{
+	UploadToken token;
+	token.firstPart = -1;
+	token.lastPart = -1;
+
+	size_t pos = 0;
+	int nlines = 0;
+	while (pos < text.length())
+	{
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+		{
+			end = text.length();
+		}
+		std::string line = text.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (nlines++ == 0)
+		{
+			if (line != TOKEN_MAGIC)
+			{
+				THROW(InvalidParameter, "not an upload token");
+			}
+		}
+		else if (line.compare(0, 7, "bucket ") == 0)
+		{
+			token.bucket = line.substr(7);
+		}
+		else if (line.compare(0, 10, "upload_id ") == 0)
+		{
+			token.uploadId = line.substr(10);
+		}
+		else if (line.compare(0, 6, "parts ") == 0)
+		{
+			std::istringstream sstr(line.substr(6));
+			sstr>>token.firstPart>>token.lastPart;
+			if (sstr.fail())
+			{
+				THROW(InvalidParameter, "upload token has a bad part range \"%s\"", line.c_str());
+			}
+		}
+		else if (line.compare(0, 4, "key ") == 0)
+		{
+			token.key = line.substr(4);
+		}
+		else
+		{
+			THROW(InvalidParameter, "upload token has a bad field \"%s\"", line.c_str());
+		}
+	}
+
+	if (token.bucket.empty() || token.key.empty() || token.uploadId.empty() ||
+			token.firstPart < 0 || token.lastPart < token.firstPart || token.lastPart >= MAX_PARTS)
+	{
+		THROW(InvalidParameter, "upload token is incomplete");
+	}
+	return token;
+}
+
+QingStorWriter::QingStorWriter(Context *context, std::string bucket,
+		ObjectInfo object, bool cache, std::string journal) : QingStorRWBase(context, bucket, object)
+{
+	mCred = {mConfiguration->mAccessKeyId, mConfiguration->mSecretAccessKey};
+	mKey = object.key;
+	mPartNum = 0;
+	mOffset = 0;
+	if (!journal.empty())
+	{
+		mJournal = shared_ptr<UploadJournal> (new UploadJournal(journal));
+	}
+	planParts(object.size);
+	mWritePos = 0;
+	mCanceled = false;
+	mCache = cache;
+	mConcurrency = mConfiguration->mUploadConcurrency;
+	mContentMD5 = mConfiguration->mEnableContentMD5;
+	mChained = mConcurrency <= 1 && mCache && (mJournal || mContentMD5);
+	mBuffer = NULL;
+	mBuffCapacity = 0;
+	mStreamBufferSize = mConfiguration->mStreamBufferSize;
+	if (mStreamBufferSize > 0 && mCache && (mJournal || mContentMD5))
+	{
+		call_once(WholePartsOnce, LogWholeParts);
+	}
+	if (mJournal || mContentMD5 || !mCache)
+	{
+		mStreamBufferSize = 0;
+	}
+	mStreamLength = 0;
+	mStreamKnown = false;
+	mStreamStarted = false;
+	mStreamCopied = false;
+	mParted = false;
+	mPartsRunning = 0;
+	mFirstPart = 0;
+	mLastPart = MAX_PARTS - 1;
+	mJoined = false;
+}
+
+void QingStorWriter::planParts(int64_t expectedSize)
+{
+	mExpectedSize = expectedSize;
+	mBasePartSize = mConfiguration->mChunkSize;
+	mGrowthStart = PARTS_PER_GROWTH;
+	if (mExpectedSize >= 0)
+	{
+		/* the smallest part size, in MB, that fits the object in the part count limit */
+		int64_t fit = (mExpectedSize + MAX_PARTS - 1) / MAX_PARTS;
+		fit = (fit + (1 << 20) - 1) & ~(int64_t)((1 << 20) - 1);
+		if (fit > mBasePartSize)
+		{
+			mBasePartSize = fit < MAX_PART_SIZE ? fit : MAX_PART_SIZE;
+		}
+		mGrowthStart = mExpectedSize / mBasePartSize + 1;
+	}
+	mBuffSize = partSize(mPartNum);
+}
+
+int64_t QingStorWriter::partSize(int32_t partNum)
+{
+	if (partNum < mGrowthStart)
+	{
+		return mBasePartSize;
+	}
+
+	int64_t size = mBasePartSize;
+	int32_t growth = 1 + (partNum - mGrowthStart) / PARTS_PER_GROWTH;
+	while (growth-- > 0 && size < MAX_PART_SIZE)
+	{
+		size <<= 1;
+	}
+	return size < MAX_PART_SIZE ? size : MAX_PART_SIZE;
+}
+
+void QingStorWriter::growBuffer(int waitMs)
+{
+	int64_t size = mBuffSize;
+
+	if (mWritePos == 0)
+	{
+		reapParts(false);
+		while (static_cast<int>(mInflightParts.size()) >= maxInflightParts())
+		{
+			mContext->uploadEngine()->wait(mInflightParts.front().part);
+			reapParts(false);
+		}
+
+		if (mPartNum == 0)
+		{
+			size = mExpectedSize > INITIAL_BUFFER_SIZE ? mExpectedSize : INITIAL_BUFFER_SIZE;
+		}
+	}
+	else
+	{
+		size = mBuffCapacity * 2;
+	}
+	if (size > mBuffSize)
+	{
+		size = mBuffSize;
+	}
+
+	int64_t capacity = 0;
+	if (mBuffer)
+	{
+		/* the pool counts the old buffer as given back, so a single writer may
+		 * grow its part up to the whole of part_buffer_limit */
+		mBuffer = mContext->partBufferPool()->resize(mBuffer, mWritePos, size, &capacity, waitMs);
+	}
+	else
+	{
+		mBuffer = mContext->partBufferPool()->acquire(size, &capacity, waitMs);
+	}
+	mBuffCapacity = capacity;
+}
+
+void QingStorWriter::spool()
+{
+	if (!mContext->spoolUploader())
+	{
+		THROW(InvalidParameter, "no spool_dir is configured to spool objects to");
+	}
+	if (mPartNum > 0 || mWritePos > 0 || mSpool)
+	{
+		THROW(InvalidParameter, "the writer has data already");
+	}
+	mSpool = mContext->spoolUploader()->create(mBucket, mKey);
+}
+
+void QingStorWriter::openParts()
+{
+	if (mPartNum > 0 || mWritePos > 0 || mSpool || mParted)
+	{
+		THROW(InvalidParameter, "the writer has data already");
+	}
+	ensureMultipartUpload();
+	mParted = true;
+}
+
+void QingStorWriter::writePart(int32_t partNumber, const char *data, int32_t length)
+{
+	if (!mParted)
+	{
+		THROW(InvalidParameter, "the object is not open for writing parts by number");
+	}
+	if (partNumber < mFirstPart || partNumber > mLastPart)
+	{
+		THROW(InvalidParameter, "part number %d is out of range [%d, %d]", partNumber,
+				mFirstPart, mLastPart);
+	}
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+	sstr<<"?part_number="<<partNumber<<"&upload_id="<<mUploadId;
+	std::string url = sstr.str();
+
+	/*
+	 * Each caller has its part on the wire at once, upload_concurrency is
+	 * for the parts a single thread runs ahead with. The transfer scheduler
+	 * holds them to max_transfers_per_host with the other transfers.
+	 */
+	{
+		lock_guard<mutex> lock(mPartMutex);
+		if (mCanceled)
+		{
+			THROW(InvalidParameter, "the upload is canceled");
+		}
+		mPartsRunning++;
+	}
+
+	shared_ptr<PartUpload> part;
+	try {
+		part = shared_ptr<PartUpload> (new PartUpload(host, url, mBucket, mCred,
+										data, length, partNumber, this));
+		if (mContentMD5)
+		{
+			part->requestDigest(true);
+		}
+		mContext->uploadEngine()->submit(part);
+		mContext->uploadEngine()->wait(part);
+	} catch (...)
+	{
+		lock_guard<mutex> lock(mPartMutex);
+		mPartsRunning--;
+		mFailedParts.insert(partNumber);
+		mPartDone.notify_all();
+		throw;
+	}
+
+	lock_guard<mutex> lock(mPartMutex);
+	mPartsRunning--;
+	mPartDone.notify_all();
+	if (part->state() != PART_DONE)
+	{
+		mETags.erase(partNumber);
+		mFailedParts.insert(partNumber);
+		THROW(QingStorNetworkException, "%s", part->error().c_str());
+	}
+	mETags[partNumber] = part->etag();
+	mFailedParts.erase(partNumber);
+}
+
+UploadToken QingStorWriter::exportToken(int32_t firstPart, int32_t lastPart)
+{
+	if (!mParted)
+	{
+		THROW(InvalidParameter, "the object is not open for writing parts by number");
+	}
+	if (firstPart < mFirstPart || lastPart > mLastPart || lastPart < firstPart)
+	{
+		THROW(InvalidParameter, "part range [%d, %d] is not within [%d, %d]", firstPart, lastPart,
+				mFirstPart, mLastPart);
+	}
+
+	UploadToken token;
+	token.bucket = mBucket;
+	token.key = mKey;
+	token.uploadId = mUploadId;
+	token.firstPart = firstPart;
+	token.lastPart = lastPart;
+	return token;
+}
+
+void QingStorWriter::joinUpload(const UploadToken &token)
+{
+	if (mPartNum > 0 || mWritePos > 0 || mSpool || mParted)
+	{
+		THROW(InvalidParameter, "the writer has data already");
+	}
+	mUploadId = token.uploadId;
+	mFirstPart = token.firstPart;
+	mLastPart = token.lastPart;
+	mParted = true;
+	mJoined = true;
+}
+
+std::string QingStorWriter::partETag(int32_t partNumber)
+{
+	lock_guard<mutex> lock(mPartMutex);
+	std::map<int32_t, std::string>::iterator itr = mETags.find(partNumber);
+	return itr == mETags.end() ? std::string() : itr->second;
+}
+
+void QingStorWriter::addPart(int32_t partNumber, const std::string &etag)
+{
+	if (!mParted || mJoined)
+	{
+		THROW(InvalidParameter, "only the owner of an upload takes the parts written elsewhere");
+	}
+	if (partNumber < 0 || partNumber >= MAX_PARTS || etag.empty())
+	{
+		THROW(InvalidParameter, "part %d with ETag \"%s\" cannot be added", partNumber, etag.c_str());
+	}
+
+	lock_guard<mutex> lock(mPartMutex);
+	mETags[partNumber] = etag;
+	mFailedParts.erase(partNumber);
+}
+
+void QingStorWriter::waitForWrittenParts()
+{
+	unique_lock<mutex> lock(mPartMutex);
+	while (mPartsRunning > 0)
+	{
+		mPartDone.wait(lock);
+	}
+}
+
+QingStorWriter::~QingStorWriter()
+{
+	/* a part still waiting for data would never end */
+	if (mStream)
+	{
+		mStream->abort();
+		mStream.reset();
+	}
+
+	/* a spooled object that was not closed is dropped */
+	if (mSpool)
+	{
+		mContext->spoolUploader()->discard(mSpool);
+	}
+
+	/* the engine may still be reading from our buffers */
+	drainParts();
+	waitForWrittenParts();
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	mContext->transferScheduler()->unregister(sstr.str(), this);
+
+	freeBuffers();
+}
+
+void QingStorWriter::freeBuffers()
+{
+	if (mBuffer)
+	{
+		mContext->partBufferPool()->release(mBuffer);
+		mBuffer = NULL;
+		mBuffCapacity = 0;
+	}
+}
+
+int32_t QingStorWriter::transferData(const char *buffer, int32_t buffsize)
+{
+	if (mParted)
+	{
+		THROW(InvalidParameter, "the parts of the object are written by number");
+	}
+
+	if (mSpool)
+	{
+		mContext->spoolUploader()->write(mSpool, buffer, buffsize);
+		return buffsize;
+	}
+
+	if(!mCache)
+	{
+		doSend(buffer, buffsize);
+		return buffsize;
+	}
+
+	if (mStreamBufferSize > 0)
+	{
+		return streamData(buffer, buffsize, mConfiguration->mPartBufferWait);
+	}
+
+	return appendData(buffer, buffsize, mConfiguration->mPartBufferWait);
+}
+
+int32_t QingStorWriter::streamData(const char *data, int32_t length, int waitMs)
+{
+	int32_t pos = 0;
+	while (pos < length)
+	{
+		if (mStream && mWritePos == mStreamLength)
+		{
+			/* held back below, but the object goes on */
+			endStream();
+		}
+		if (!mStream)
+		{
+			try {
+				openStream(waitMs);
+			} catch (const QingStorWouldBlock & e)
+			{
+				if (pos > 0)
+				{
+					return pos;
+				}
+				throw;
+			}
+		}
+
+		int64_t n = mStreamLength - mWritePos;
+		if (n > length - pos)
+		{
+			n = length - pos;
+		}
+		n = mStream->write(data + pos, n);
+		if (mStreamCopied)
+		{
+			memcpy(mBuffer + mWritePos, data + pos, n);
+		}
+		mWritePos += n;
+		pos += n;
+
+		if (mWritePos == mStreamLength)
+		{
+			/* an object that ends with its first part is kept for a single PUT */
+			if (mStreamStarted || !mUploadId.empty() || mOffset + mWritePos != mExpectedSize)
+			{
+				endStream();
+			}
+		}
+		else if (n == 0)
+		{
+			/* the ring is full, the part has to go out to make room */
+			if (!mStreamStarted)
+			{
+				startStream(false);
+			}
+			else if (!mStream->waitForRoom())
+			{
+				reapParts(true);
+				THROW(QingStorIOException, "upload of part %d ended before all of its data", mPartNum);
+			}
+		}
+		else if (mStreamStarted)
+		{
+			mContext->uploadEngine()->wakeup();
+		}
+	}
+
+	return length;
+}
+
+void QingStorWriter::openStream(int waitMs)
+{
+	reapParts(false);
+	while (static_cast<int>(mInflightParts.size()) >= maxInflightParts())
+	{
+		mContext->uploadEngine()->wait(mInflightParts.front().part);
+		reapParts(false);
+	}
+
+	/* up to the expected size, the parts are as large as planned */
+	mStreamLength = mBuffSize;
+	mStreamKnown = mExpectedSize > mOffset;
+	if (mStreamKnown && mExpectedSize - mOffset < mStreamLength)
+	{
+		mStreamLength = mExpectedSize - mOffset;
+	}
+
+	int64_t capacity = mStreamBufferSize < mStreamLength ? mStreamBufferSize : mStreamLength;
+	mStream = shared_ptr<PartStream> (new PartStream(mContext->partBufferPool(), capacity, waitMs));
+	mStreamStarted = false;
+	mStreamCopied = false;
+	mWritePos = 0;
+}
+
+void QingStorWriter::startStream(bool complete)
+{
+	ensureMultipartUpload();
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+	sstr<<"?part_number="<<mPartNum<<"&upload_id="<<mUploadId;
+	std::string url = sstr.str();
+
+	int64_t length = -1;
+	if (complete)
+	{
+		length = mWritePos;
+	}
+	else if (mStreamKnown)
+	{
+		length = mStreamLength;
+	}
+	else
+	{
+		/*
+		 * None of the ring is read yet, it all goes to the copy. Do not wait
+		 * for memory: the ring is held meanwhile, and chunked does as well.
+		 */
+		if (mBuffer && mBuffCapacity < mStreamLength)
+		{
+			freeBuffers();
+		}
+		try {
+			if (!mBuffer)
+			{
+				int64_t capacity = 0;
+				mBuffer = mContext->partBufferPool()->acquire(mStreamLength, &capacity, 0);
+				mBuffCapacity = capacity;
+			}
+			int64_t size = 0;
+			const char *data = mStream->contents(&size);
+			memcpy(mBuffer, data, size);
+			mStreamCopied = true;
+			length = mStreamLength;
+		} catch (const QingStorWouldBlock & e)
+		{
+			call_once(ChunkedPartsOnce, LogChunkedParts);
+		}
+	}
+
+	InflightPart inflight;
+	inflight.part = shared_ptr<PartUpload> (new PartUpload(host, url, mBucket, mCred,
+										NULL, length, mPartNum, this));
+	inflight.part->streamFrom(mStream);
+	inflight.offset = mOffset;
+	inflight.buffer = NULL;
+	inflight.freeFn = NULL;
+	inflight.freeArg = NULL;
+	mContext->uploadEngine()->submit(inflight.part);
+	mInflightParts.push_back(inflight);
+	mStreamStarted = true;
+}
+
+void QingStorWriter::endStream()
+{
+	if (!mStreamStarted)
+	{
+		startStream(true);
+	}
+	mStream->finish();
+	mContext->uploadEngine()->wakeup();
+	mStream.reset();
+
+	mOffset += mWritePos;
+	mPartNum++;
+	mBuffSize = partSize(mPartNum);
+	mWritePos = 0;
+	mStreamStarted = false;
+	mStreamCopied = false;
+}
+
+void QingStorWriter::resendStream()
+{
+	mStream->abort();
+	mStream.reset();
+	mContext->uploadEngine()->wakeup();
+	mStreamStarted = false;
+	mStreamCopied = false;
+
+	/* the stream was the last part submitted */
+	InflightPart inflight = mInflightParts.back();
+	mInflightParts.pop_back();
+	mContext->uploadEngine()->wait(inflight.part);
+
+	LOG(DEBUG1, "object ended at %lld bytes, within part %d, sending it again with its length",
+			static_cast<long long>(mOffset + mWritePos), mPartNum);
+	submitPart(mBuffer, mWritePos);
+	mBuffer = NULL;
+	mBuffCapacity = 0;
+	mWritePos = 0;
+}
+
+int32_t QingStorWriter::appendData(const char *data, int32_t length, int waitMs)
+{
+	int32_t buffPos = 0;
+	while (buffPos != length)
+	{
+		if (mWritePos == mBuffCapacity)
+		{
+			try {
+				growBuffer(waitMs);
+			} catch (const QingStorWouldBlock & e)
+			{
+				if (buffPos > 0)
+				{
+					return buffPos;
+				}
+				throw;
+			}
+		}
+
+		/* a buffer of the pool may be larger than asked for */
+		int64_t n = (mBuffCapacity < mBuffSize ? mBuffCapacity : mBuffSize) - mWritePos;
+		if (n > length - buffPos)
+		{
+			n = length - buffPos;
+		}
+		memcpy(mBuffer + mWritePos, data + buffPos, n);
+		mWritePos += n;
+		buffPos += n;
+
+		if (mWritePos == mBuffSize)
+		{
+			sendBuffer();
+		}
+	}
+
+	return length;
+}
+
+int QingStorWriter::maxInflightParts()
+{
+	return mChained ? 2 : mConcurrency;
+}
+
+void QingStorWriter::sendBuffer()
+{
+	if (mConcurrency > 1 || mChained)
+	{
+		submitPart(mBuffer, mWritePos);
+		/* the part owns the buffer now */
+		mBuffer = NULL;
+		mBuffCapacity = 0;
+	}
+	else
+	{
+		doSend(mBuffer, mWritePos);
+		/* the part is acknowledged, the memory is for whoever needs it next */
+		freeBuffers();
+	}
+	mWritePos = 0;
+}
+
+void QingStorWriter::donateData(char *buffer, int32_t length, void (*freeFn)(void *, void *), void *arg)
+{
+	if (mParted)
+	{
+		THROW(InvalidParameter, "the parts of the object are written by number");
+	}
+
+	if (mSpool)
+	{
+		mContext->spoolUploader()->write(mSpool, buffer, length);
+		freeFn(buffer, arg);
+		return;
+	}
+
+	/* the data goes through the ring anyway, it is not worth holding the buffer */
+	if (mStreamBufferSize > 0)
+	{
+		streamData(buffer, length, -1);
+		freeFn(buffer, arg);
+		return;
+	}
+
+	if (!mCache)
+	{
+		submitDonatedPart(buffer, length, buffer, freeFn, arg);
+		return;
+	}
+
+	int64_t minPartSize = mBuffSize < MIN_PART_SIZE ? mBuffSize : MIN_PART_SIZE;
+	int32_t copied = 0;
+
+	/*
+	 * Data buffered already goes out first. Top it up to a valid part from
+	 * the donated buffer, unless the rest of the donated buffer would then
+	 * be too small to be a part of its own.
+	 */
+	if (mWritePos > 0)
+	{
+		copied = length;
+		if (mWritePos < minPartSize && length - (minPartSize - mWritePos) >= minPartSize)
+		{
+			copied = minPartSize - mWritePos;
+		}
+		else if (mWritePos >= minPartSize && length >= minPartSize)
+		{
+			copied = 0;
+		}
+		appendData(buffer, copied, -1);
+		if (copied < length && mWritePos > 0)
+		{
+			sendBuffer();
+		}
+	}
+
+	if (copied == length)
+	{
+		freeFn(buffer, arg);
+	}
+	else if (length - copied < minPartSize)
+	{
+		/* a small tail waits for more data in the part buffer */
+		appendData(buffer + copied, length - copied, -1);
+		freeFn(buffer, arg);
+	}
+	else
+	{
+		submitDonatedPart(buffer + copied, length - copied, buffer, freeFn, arg);
+	}
+}
+
+void QingStorWriter::submitDonatedPart(char *data, int32_t length, char *buffer,
+							void (*freeFn)(void *, void *), void *arg)
+{
+	if (mConcurrency <= 1 && !mChained)
+	{
+		doSend(data, length);
+		freeFn(buffer, arg);
+		return;
+	}
+
+	/* a donated part takes an upload slot like any other */
+	reapParts(false);
+	while (static_cast<int>(mInflightParts.size()) >= maxInflightParts())
+	{
+		mContext->uploadEngine()->wait(mInflightParts.front().part);
+		reapParts(false);
+	}
+
+	submitPart(data, length);
+	mInflightParts.back().buffer = buffer;
+	mInflightParts.back().freeFn = freeFn;
+	mInflightParts.back().freeArg = arg;
+}
+
+void QingStorWriter::putFile(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) != 0)
+	{
+		THROW(QingStorIOException, "could not stat the file to upload: %s", GetSystemErrorInfo(errno));
+	}
+	if (!S_ISREG(st.st_mode))
+	{
+		THROW(InvalidParameter, "only a regular file can be uploaded from its descriptor");
+	}
+	if (mPartNum > 0 || mWritePos > 0 || mParted)
+	{
+		THROW(InvalidParameter, "the writer has data already");
+	}
+
+	int64_t size = st.st_size;
+	planParts(size);
+	posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+	if (size <= mBuffSize)
+	{
+		/* one request, sent from a mapping of the file rather than a copy */
+		void *map = NULL;
+		if (size > 0)
+		{
+			map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED)
+			{
+				THROW(QingStorIOException, "could not map the file to upload: %s", GetSystemErrorInfo(errno));
+			}
+		}
+		try {
+			putObject(map ? (const char *)map : "", size);
+		} catch (...)
+		{
+			if (map)
+			{
+				munmap(map, size);
+			}
+			throw;
+		}
+		if (map)
+		{
+			munmap(map, size);
+		}
+		return;
+	}
+
+	try {
+		while (mOffset < size)
+		{
+			int64_t length = size - mOffset < mBuffSize ? size - mOffset : mBuffSize;
+
+			reapParts(false);
+			while (static_cast<int>(mInflightParts.size()) >= maxInflightParts())
+			{
+				mContext->uploadEngine()->wait(mInflightParts.front().part);
+				reapParts(false);
+			}
+			submitPart(NULL, length, fd);
+		}
+		reapParts(true);
+	} catch (...)
+	{
+		/* the parts are read from fd, they must be over before the caller gets it back */
+		try {
+			cancel();
+		} catch (...)
+		{
+		}
+		throw;
+	}
+
+	close();
+}
+
+void QingStorWriter::initMultipartUpload(std::string host, std::string url, std::string bucket,
+						QSCredential *cred)
+{
+	struct json_object* resp_body = NULL;
+
+	try {
+		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL,
+							cred, QSRT_INIT_MP_UPLOAD, NULL, mConfiguration->mConnectionRetries,
+							mContext->connectionPool().get());
+		if (!resp_body)
+		{
+			THROW(QingStorNetworkException, "could not init multipart upload");
+		}
+		if (!extractUploadIDContent(resp_body))
+		{
+			struct json_object *code = NULL;
+			const char *err_code = NULL;
+			if (!json_object_object_get_ex(resp_body, "code", &code))
+			{
+				THROW(QingStorNetworkException, "could not init multipart with message \"%s\"",
+										json_object_to_json_string(resp_body));
+			}
+			err_code = json_object_get_string(code);
+
+			if (strcmp(err_code, "permission_denied") == 0)
+			{
+				THROW(QingStorNetworkException, "you don't have enough permission to access"
+						" bucket %s", bucket.c_str());
+			}
+			else
+			{
+				THROW(QingStorNetworkException, "could not init multipart with message \"%s\"",
+										json_object_to_json_string(resp_body));
+			}
+			json_object_put(resp_body);
+		}
+	} catch (QingStorException & e)
+	{
+		/* always cleanup */
+		if (resp_body)
+		{
+			json_object_put(resp_body);
+		}
+
+		throw e;
+	}
+	return;
+}
+
+void QingStorWriter::ensureMultipartUpload()
+{
+	if (!mUploadId.empty())
+	{
+		return;
+	}
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey<<"?uploads";
+	std::string url = sstr.str();
+
+	initMultipartUpload(host, url, mBucket, &mCred);
+
+	if (mJournal)
+	{
+		mJournal->start(mBucket, mKey, mUploadId);
+	}
+}
+
+void QingStorWriter::putObject(const char *data, int64_t length)
+{
+	struct json_object *resp_body = NULL;
+	MemoryData md;
+	md.advance = data;
+	md.sizeleft = length;
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+	std::string url = sstr.str();
+
+	std::string contentMD5;
+	if (mContentMD5)
+	{
+		inlineDigest(data, length, &contentMD5);
+	}
+
+	mContext->transferScheduler()->acquireDemand(host, this);
+
+	try {
+		resp_body = DoGetJSON(host.c_str(), url.c_str(), mBucket.c_str(), NULL, &mCred, QSRT_PUT_OBJECT, &md,
+							mConfiguration->mConnectionRetries, mContext->connectionPool().get(),
+							contentMD5.empty() ? NULL : contentMD5.c_str());
+		mContext->transferScheduler()->release(host, this);
+		if (resp_body)
+		{
+			json_object_put(resp_body);
+		}
+	} catch (QingStorException & e)
+	{
+		mContext->transferScheduler()->release(host, this);
+		if (resp_body)
+		{
+			json_object_put(resp_body);
+		}
+		throw e;
+	}
+}
+
+std::string QingStorWriter::inlineDigest(const char *data, int64_t length, std::string *contentMD5)
+{
+	unsigned char md5[16];
+	char hex[33];
+
+	if (!mContentMD5 && !mJournal)
+	{
+		return std::string();
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+	if (!md5sum(data, length, md5))
+	{
+		THROW(QingStorIOException, "could not compute the MD5 of part %d", mPartNum);
+	}
+	HexEncode(md5, 16, hex);
+	if (mContentMD5)
+	{
+		char *base64 = Base64Encode((const char *)md5, 16);
+		*contentMD5 = base64;
+		free(base64);
+	}
+	mContext->uploadEngine()->addInlineDigest(length,
+			duration_cast<microseconds>(steady_clock::now() - start).count());
 
-namespace QingStor {
-namespace Internal {
+	return std::string(hex);
+}
+
+void QingStorWriter::journalPart(int32_t partNumber, int64_t offset, int64_t length,
+							const std::string &md5, const std::string &etag)
+{
+	if (!mJournal)
+	{
+		return;
+	}
+
+	JournalPart part;
+	part.partNumber = partNumber;
+	part.offset = offset;
+	part.size = length;
+	part.md5 = md5;
+
+	/* stored without the quotes, a record is a list of words */
+	part.etag = etag;
+	if (part.etag.length() >= 2 && part.etag[0] == '"' && part.etag[part.etag.length() - 1] == '"')
+	{
+		part.etag = part.etag.substr(1, part.etag.length() - 2);
+	}
+	mJournal->addPart(part);
+}
 
-QingStorWriter::QingStorWriter(shared_ptr<Configuration> configuration, std::string bucket,
-		ObjectInfo object, bool cache) : QingStorRWBase(configuration, bucket, object)
+bool QingStorWriter::listParts(std::map<int32_t, JournalPart> &parts)
 {
+	static const int32_t LIST_LIMIT = 1000;
+
 	std::stringstream sstr;
-	sstr<<bucket<<"."<<configuration->mLocation<<"."<<configuration->mHost;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
 	std::string host = sstr.str();
 	sstr.str("");
 	sstr.clear();
 
-	sstr<<configuration->mProtocol<<"://"<<host<<"/"<<object.key<<"?uploads";
-	std::string url = sstr.str();
-	sstr.str("");
-	sstr.clear();
+	int32_t marker = 0;
+	while (true)
+	{
+		sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey<<"?limit="<<LIST_LIMIT
+			<<"&part_number_marker="<<marker<<"&upload_id="<<mUploadId;
+		std::string url = sstr.str();
+		sstr.str("");
+		sstr.clear();
 
-	mCred = {configuration->mAccessKeyId, configuration->mSecretAccessKey};
-	initMultipartUpload(host, url, bucket, &mCred);
-	mPartNum = 0;
-	mBuffSize = configuration->mChunkSize;
-	mWritePos = 0;
-	mCanceled = false;
-	mCache = cache;
-	if(mCache)
-		mBuffer = new char[mBuffSize];
-	else
-		mBuffer = NULL;
-}
+		struct json_object *resp_body = DoGetJSON(host.c_str(), url.c_str(), mBucket.c_str(), NULL,
+							&mCred, QSRT_LIST_MP, NULL, mConfiguration->mConnectionRetries,
+							mContext->connectionPool().get());
+		if (!resp_body)
+		{
+			THROW(QingStorNetworkException, "could not list the parts of upload %s", mUploadId.c_str());
+		}
 
-void QingStorWriter::transferData(const char *buffer, int32_t buffsize)
-{
-	if(!mCache)
-	{
-		doSend(buffer, buffsize);
-	}
-	else
-	{
-		int32_t buffPos = 0;
-		while (buffPos != buffsize)
+		struct json_object *object_parts = NULL;
+		if (!json_object_object_get_ex(resp_body, "object_parts", &object_parts))
+		{
+			/* e.g. the upload was completed or aborted */
+			LOG(WARNING, "could not list the parts of upload %s: %s", mUploadId.c_str(),
+					json_object_to_json_string(resp_body));
+			json_object_put(resp_body);
+			return false;
+		}
+
+		int32_t count = json_object_array_length(object_parts);
+		int32_t next = marker;
+		for (int32_t i = 0; i < count; i++)
 		{
-			while (mWritePos != mBuffSize)
+			struct json_object *element = json_object_array_get_idx(object_parts, i);
+			struct json_object *value = NULL;
+			JournalPart part;
+
+			if (!json_object_object_get_ex(element, "part_number", &value))
 			{
-				mBuffer[mWritePos++] = buffer[buffPos++];
-				if (buffPos == buffsize)
-				{
-					break;
-				}
+				continue;
+			}
+			part.partNumber = json_object_get_int(value);
+			part.offset = -1;
+			part.size = -1;
+			if (json_object_object_get_ex(element, "size", &value))
+			{
+				part.size = json_object_get_int64(value);
+			}
+			if (json_object_object_get_ex(element, "etag", &value))
+			{
+				part.etag = json_object_get_string(value);
 			}
-			if (mWritePos == mBuffSize)
+			parts[part.partNumber] = part;
+			if (part.partNumber >= next)
 			{
-				doSend(mBuffer, mBuffSize);
-				mWritePos = 0;
+				next = part.partNumber + 1;
 			}
 		}
+		json_object_put(resp_body);
+
+		if (count < LIST_LIMIT || next == marker)
+		{
+			break;
+		}
+		marker = next;
 	}
 
-	return;
+	return true;
 }
 
-void QingStorWriter::initMultipartUpload(std::string host, std::string url, std::string bucket,
-						QSCredential *cred)
+int64_t QingStorWriter::resume()
 {
-	struct json_object* resp_body = NULL;
+	if (!mJournal)
+	{
+		THROW(InvalidParameter, "the writer of %s has no upload journal", mKey.c_str());
+	}
+	if (!mJournal->load())
+	{
+		return 0;
+	}
+	if (mJournal->bucket() != mBucket || mJournal->key() != mKey)
+	{
+		THROW(InvalidParameter, "upload journal %s is for object %s/%s, not %s/%s",
+				mJournal->path().c_str(), mJournal->bucket().c_str(), mJournal->key().c_str(),
+				mBucket.c_str(), mKey.c_str());
+	}
 
-	try {
-		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL,
-							cred, QSRT_INIT_MP_UPLOAD, NULL, mConfiguration->mConnectionRetries);
-		if (!resp_body)
+	mUploadId = mJournal->uploadId();
+	std::map<int32_t, JournalPart> listed;
+	if (!listParts(listed))
+	{
+		/* nothing to take over, the upload starts again with a new id */
+		mUploadId.clear();
+		return 0;
+	}
+
+	/*
+	 * Keep the parts both in the journal and on the server, with the same
+	 * size and data, in a row from the first one. The parts past a gap are
+	 * sent again, over those the server may have.
+	 */
+	const std::map<int32_t, JournalPart> &journaled = mJournal->parts();
+	int32_t partNum = 0;
+	int64_t offset = 0;
+	while (true)
+	{
+		std::map<int32_t, JournalPart>::const_iterator jitr = journaled.find(partNum);
+		std::map<int32_t, JournalPart>::iterator litr = listed.find(partNum);
+		if (jitr == journaled.end() || litr == listed.end())
 		{
-			THROW(QingStorNetworkException, "could not init multipart upload");
+			break;
 		}
-		if (!extractUploadIDContent(resp_body))
-		{
-			struct json_object *code = NULL;
-			const char *err_code = NULL;
-			if (!json_object_object_get_ex(resp_body, "code", &code))
-			{
-				THROW(QingStorNetworkException, "could not init multipart with message \"%s\"",
-										json_object_to_json_string(resp_body));
-			}
-			err_code = json_object_get_string(code);
+		const JournalPart &local = jitr->second;
+		const JournalPart &remote = litr->second;
 
-			if (strcmp(err_code, "permission_denied") == 0)
-			{
-				THROW(QingStorNetworkException, "you don't have enough permission to access"
-						" bucket %s", bucket.c_str());
-			}
-			else
-			{
-				THROW(QingStorNetworkException, "could not init multipart with message \"%s\"",
-										json_object_to_json_string(resp_body));
-			}
-			json_object_put(resp_body);
+		std::string etag = remote.etag;
+		if (etag.length() >= 2 && etag[0] == '"' && etag[etag.length() - 1] == '"')
+		{
+			etag = etag.substr(1, etag.length() - 2);
 		}
-	} catch (QingStorException & e)
-	{
-		/* always cleanup */
-		if (resp_body)
+		if (local.offset != offset || local.size != remote.size ||
+				(!local.etag.empty() && local.etag != etag) ||
+				(local.etag.empty() && etag.length() == 32 && etag != local.md5))
 		{
-			json_object_put(resp_body);
+			LOG(WARNING, "part %d of upload %s does not match its journal record, it is sent again",
+					partNum, mUploadId.c_str());
+			break;
 		}
 
-		throw e;
+		mETags[partNum] = remote.etag;
+		offset += local.size;
+		partNum++;
 	}
-	return;
+
+	mJournal->reopen();
+	mPartNum = partNum;
+	mOffset = offset;
+	mBuffSize = partSize(mPartNum);
+
+	LOG(INFO, "resumed upload %s of %s/%s at part %d, offset %lld", mUploadId.c_str(),
+			mBucket.c_str(), mKey.c_str(), mPartNum, static_cast<long long>(mOffset));
+	return mOffset;
 }
 
 bool QingStorWriter::extractUploadIDContent(struct json_object *resp_body)
@@ -168,21 +1267,28 @@ bool QingStorWriter::extractUploadIDContent(struct json_object *resp_body)
 }
 
 bool QingStorWriter::uploadMultipart(std::string host, std::string url, std::string bucket, QSCredential *cred,
-							const char *data, int32_t length)
+							const char *data, int32_t length, const char *contentMD5)
 {
 	struct json_object *resp_body = NULL;
 	MemoryData md;
 	md.advance = data;
 	md.sizeleft = length;
 
+	/* the writer waits for this part, it is a demand transfer */
+	mContext->transferScheduler()->acquireDemand(host, this);
+
 	try {
-		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL, cred, QSRT_UPLOAD_MP, &md, mConfiguration->mConnectionRetries);
+		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL, cred, QSRT_UPLOAD_MP, &md, mConfiguration->mConnectionRetries,
+							mContext->connectionPool().get(), contentMD5);
+		mContext->transferScheduler()->release(host, this);
 		if (resp_body)
 		{
 			json_object_put(resp_body);
 		}
 	} catch (QingStorException & e)
 	{
+		mContext->transferScheduler()->release(host, this);
+
 		/*
 		 * always cleanup
 		 */
@@ -199,6 +1305,8 @@ bool QingStorWriter::uploadMultipart(std::string host, std::string url, std::str
 
 void QingStorWriter::doSend(const char *data, int32_t length)
 {
+	ensureMultipartUpload();
+
 	std::stringstream sstr;
 	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
 	std::string host = sstr.str();
@@ -211,23 +1319,176 @@ void QingStorWriter::doSend(const char *data, int32_t length)
 	sstr.str("");
 	sstr.clear();
 
-	if (!uploadMultipart(host.c_str(), url.c_str(), mBucket.c_str(), &mCred, data, length))
+	std::string contentMD5;
+	std::string md5 = inlineDigest(data, length, &contentMD5);
+	if (!uploadMultipart(host.c_str(), url.c_str(), mBucket.c_str(), &mCred, data, length,
+				contentMD5.empty() ? NULL : contentMD5.c_str()))
 	{
 		THROW(QingStorIOException, "writer transfer data");
 	}
 	else
 	{
+		journalPart(mPartNum, mOffset, length, md5, std::string());
+		mOffset += length;
 		mPartNum++;
+		mBuffSize = partSize(mPartNum);
 	}
 
 	return;
 }
 
+void QingStorWriter::submitPart(char *data, int32_t length, int fd)
+{
+	ensureMultipartUpload();
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+	sstr<<"?part_number="<<mPartNum<<"&upload_id="<<mUploadId;
+	std::string url = sstr.str();
+
+	InflightPart inflight;
+	inflight.part = shared_ptr<PartUpload> (new PartUpload(host, url, mBucket, mCred,
+										data, length, mPartNum, this));
+	inflight.offset = mOffset;
+	if (fd >= 0)
+	{
+		inflight.part->readFrom(fd, mOffset);
+	}
+	if (mContentMD5 || mJournal)
+	{
+		/* computed by the engine while the parts before are on the wire */
+		inflight.part->requestDigest(mContentMD5);
+	}
+	if (mChained && !mInflightParts.empty())
+	{
+		inflight.part->runAfter(mInflightParts.back().part);
+	}
+	if (data && data == mBuffer)
+	{
+		inflight.part->lendBuffer(mContext->partBufferPool(), mBuffer);
+	}
+	inflight.buffer = NULL;
+	inflight.freeFn = NULL;
+	inflight.freeArg = NULL;
+	mContext->uploadEngine()->submit(inflight.part);
+	mInflightParts.push_back(inflight);
+	mOffset += length;
+	mPartNum++;
+	mBuffSize = partSize(mPartNum);
+}
+
+void QingStorWriter::recycleBuffer(InflightPart &inflight)
+{
+	if (inflight.freeFn)
+	{
+		inflight.freeFn(inflight.buffer, inflight.freeArg);
+	}
+}
+
+void QingStorWriter::reapParts(bool wait)
+{
+	std::string error;
+
+	while (!mInflightParts.empty())
+	{
+		InflightPart inflight = mInflightParts.front();
+		shared_ptr<PartUpload> part = inflight.part;
+		if (!mContext->uploadEngine()->finished(part))
+		{
+			if (!wait)
+			{
+				break;
+			}
+			mContext->uploadEngine()->wait(part);
+		}
+		mInflightParts.pop_front();
+		recycleBuffer(inflight);
+
+		if (part->state() == PART_DONE)
+		{
+			mETags[part->partNumber()] = part->etag();
+			journalPart(part->partNumber(), inflight.offset, part->length(), part->md5(), part->etag());
+		}
+		else if (error.empty())
+		{
+			error = part->error();
+		}
+	}
+
+	if (!error.empty())
+	{
+		THROW(QingStorNetworkException, "%s", error.c_str());
+	}
+}
+
+void QingStorWriter::drainParts()
+{
+	while (!mInflightParts.empty())
+	{
+		InflightPart inflight = mInflightParts.front();
+		mContext->uploadEngine()->wait(inflight.part);
+		mInflightParts.pop_front();
+		recycleBuffer(inflight);
+	}
+}
+
 void QingStorWriter::flush()
 {
-	if(mCache)
+	if (mStream && mUploadId.empty() && !mStreamStarted)
 	{
-		doSend(mBuffer, mWritePos);
+		/* the whole object is in the ring, it goes with a single request */
+		int64_t length = 0;
+		const char *data = mStream->contents(&length);
+		putObject(data, length);
+		mStream.reset();
+		mWritePos = 0;
+	}
+	else if (mUploadId.empty())
+	{
+		/* not a single part went out, the object is small enough for one request */
+		putObject(mBuffer, mWritePos);
+		mWritePos = 0;
+	}
+	else if (mStreamBufferSize > 0)
+	{
+		if (mStream && mStreamStarted && mWritePos < mStreamLength && mStreamKnown)
+		{
+			THROW(QingStorIOException, "object ended at %lld bytes, short of its expected size %lld",
+					static_cast<long long>(mOffset + mWritePos), static_cast<long long>(mExpectedSize));
+		}
+		if (mStream && mStreamStarted && mWritePos < mStreamLength && mStreamCopied)
+		{
+			resendStream();
+		}
+		else if (mStream)
+		{
+			endStream();
+		}
+		reapParts(true);
+	}
+	else if(mCache && (mConcurrency > 1 || mChained))
+	{
+		if (mWritePos > 0 || mPartNum == 0)
+		{
+			submitPart(mBuffer, mWritePos);
+			mBuffer = NULL;
+			mBuffCapacity = 0;
+			mWritePos = 0;
+		}
+		reapParts(true);
+	}
+	else if(mCache)
+	{
+		/* nothing is left when the data ended on a part boundary */
+		if (mWritePos > 0 || mPartNum == 0)
+		{
+			doSend(mBuffer, mWritePos);
+		}
 		mWritePos = 0;
 	}
 	else
@@ -241,36 +1502,123 @@ void QingStorWriter::flush()
 
 void QingStorWriter::close()
 {
+	if (mSpool)
+	{
+		if (!mCanceled)
+		{
+			mContext->spoolUploader()->commit(mSpool);
+		}
+		mSpool.reset();
+		return;
+	}
+
+	if (mParted && !mCanceled)
+	{
+		closeParts();
+		return;
+	}
+
 	if (!mCanceled)
 	{
+		bool multipart = !mUploadId.empty();
+
 		flush();
 
-		std::stringstream sstr;
-		sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
-		std::string host = sstr.str();
-		sstr.str("");
-		sstr.clear();
+		if (multipart)
+		{
+			std::stringstream sstr;
+			sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+			std::string host = sstr.str();
+			sstr.str("");
+			sstr.clear();
 
-		sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
-		sstr<<"?upload_id="<<mUploadId;
-		std::string url = sstr.str();
-		sstr.str("");
-		sstr.clear();
+			sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+			sstr<<"?upload_id="<<mUploadId;
+			std::string url = sstr.str();
+			sstr.str("");
+			sstr.clear();
 
-		completeMultipartUpload(host.c_str(), url.c_str(), mBucket, &mCred);
+			if (completeMultipartUpload(host.c_str(), url.c_str(), mBucket, &mCred) && mJournal)
+			{
+				mJournal->remove();
+			}
+		}
 	}
 
-	if (mBuffer)
+	freeBuffers();
+
+	return;
+}
+
+void QingStorWriter::closeParts()
+{
+	waitForWrittenParts();
+	if (!mFailedParts.empty())
 	{
-		delete [] mBuffer;
-		mBuffer = NULL;
+		THROW(QingStorIOException, "part %d failed and was not written again", *mFailedParts.begin());
 	}
 
-	return;
+	/* the owner of the upload completes it */
+	if (mJoined)
+	{
+		return;
+	}
+
+	std::stringstream sstr;
+	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
+	std::string host = sstr.str();
+	sstr.str("");
+	sstr.clear();
+
+	sstr<<mConfiguration->mProtocol<<"://"<<host<<"/"<<mKey;
+	sstr<<"?upload_id="<<mUploadId;
+	std::string url = sstr.str();
+
+	if (mETags.empty())
+	{
+		/* an upload cannot be completed without parts, an empty object goes with one request */
+		abortMultipartUpload(host, url, mBucket, &mCred);
+		putObject("", 0);
+		return;
+	}
+	completeMultipartUpload(host, url, mBucket, &mCred);
 }
 
 void QingStorWriter::cancel()
 {
+	if (mParted)
+	{
+		lock_guard<mutex> lock(mPartMutex);
+		mCanceled = true;
+	}
+
+	if (mStream)
+	{
+		mStream->abort();
+		mStream.reset();
+		mWritePos = 0;
+		mStreamStarted = false;
+	}
+
+	if (mSpool)
+	{
+		mContext->spoolUploader()->discard(mSpool);
+		mSpool.reset();
+		mCanceled = true;
+		return;
+	}
+
+	drainParts();
+	waitForWrittenParts();
+
+	/* nothing was sent yet, or the upload is not ours to abort */
+	if (mUploadId.empty() || mJoined)
+	{
+		mWritePos = 0;
+		mCanceled = true;
+		return;
+	}
+
 	std::stringstream sstr;
 	sstr<<mBucket<<"."<<mConfiguration->mLocation<<"."<<mConfiguration->mHost;
 	std::string host = sstr.str();
@@ -283,6 +1631,10 @@ void QingStorWriter::cancel()
 	sstr.str("");
 	sstr.clear();
 	abortMultipartUpload(host.c_str(), url.c_str(), mBucket, &mCred);
+	if (mJournal)
+	{
+		mJournal->remove();
+	}
 	mPartNum = 0;
 	mCanceled = true;
 	return;
@@ -314,9 +1666,30 @@ bool QingStorWriter::completeMultipartUpload(std::string host, std::string url,
 				THROW(OutOfMemoryException, "could not create new json object");
 			}
 			json_object_object_add(req_body, "object_parts", value);
-			for(i = 0; i < mPartNum; i++)
+
+			/* parts written by number may have gaps, the others run from 0 */
+			std::vector<int32_t> parts;
+			if (mParted)
+			{
+				std::map<int32_t, std::string>::iterator pitr = mETags.begin();
+				for (; pitr != mETags.end(); pitr++)
+				{
+					parts.push_back(pitr->first);
+				}
+			}
+			else
+			{
+				for (i = 0; i < mPartNum; i++)
+				{
+					parts.push_back(i);
+				}
+			}
+
+			for (size_t j = 0; j < parts.size(); j++)
 			{
 				struct json_object *part_num_obj;
+
+				i = parts[j];
 				struct json_object *element;
 
 				part_num_obj = json_object_new_int(i);
@@ -331,6 +1704,19 @@ bool QingStorWriter::completeMultipartUpload(std::string host, std::string url,
 					THROW(OutOfMemoryException, "could not create new json object");
 				}
 				json_object_object_add(element, "part_number", part_num_obj);
+
+				/* the server checks the parts it got against the ETags we saw */
+				std::map<int32_t, std::string>::iterator eitr = mETags.find(i);
+				if (eitr != mETags.end() && !eitr->second.empty())
+				{
+					struct json_object *etag_obj = json_object_new_string(eitr->second.c_str());
+					if (!etag_obj)
+					{
+						json_object_put(element);
+						THROW(OutOfMemoryException, "could not create new json object");
+					}
+					json_object_object_add(element, "etag", etag_obj);
+				}
 				if (json_object_array_add(value, element) != 0)
 				{
 					json_object_put(element);
@@ -344,7 +1730,8 @@ bool QingStorWriter::completeMultipartUpload(std::string host, std::string url,
 		md.sizeleft = strlen(body);
 
 		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL,
-								cred, QSRT_COMP_MP_UPLOAD, &md, mConfiguration->mConnectionRetries);
+								cred, QSRT_COMP_MP_UPLOAD, &md, mConfiguration->mConnectionRetries,
+								mContext->connectionPool().get());
 		if (resp_body)
 		{
 			json_object_put(resp_body);
@@ -375,7 +1762,8 @@ bool QingStorWriter::abortMultipartUpload(std::string host, std::string url, std
 
 	try {
 		resp_body = DoGetJSON(host.c_str(), url.c_str(), bucket.c_str(), NULL,
-								cred, QSRT_ABORT_MP_UPLOAD, NULL, mConfiguration->mConnectionRetries);
+								cred, QSRT_ABORT_MP_UPLOAD, NULL, mConfiguration->mConnectionRetries,
+								mContext->connectionPool().get());
 		if (resp_body) {
 			json_object_put(resp_body);
 		}
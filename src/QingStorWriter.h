@@ -25,21 +25,134 @@
 
 #include "QingStorRWBase.h"
 #include "QingStorCommon.h"
+#include "UploadEngine.h"
+#include "UploadJournal.h"
+#include "SpoolUploader.h"
+#include "Thread.h"
+
+#include <list>
+#include <map>
+#include <set>
 
 namespace QingStor {
 namespace Internal {
 
+/*
+ * What a writer of another process needs to upload parts of a multipart
+ * upload it does not own: the object, the upload id and the range of part
+ * numbers it may write, both ends included. It goes around as text, a line
+ * per field under a magic line.
+ */
+class UploadToken {
+public:
+	std::string bucket;
+	std::string key;
+	std::string uploadId;
+	int32_t firstPart;
+	int32_t lastPart;
+
+	std::string serialize() const;
+
+	/*
+	 * Throws InvalidParameter if text is not a token.
+	 */
+	static UploadToken parse(const std::string &text);
+};
+
 class QingStorWriter : public QingStorRWBase {
 public:
-	QingStorWriter(shared_ptr<Configuration> configuration, std::string bucket, ObjectInfo object, bool canche);
+	/*
+	 * object.size is the expected size of the object if known, or -1. It is
+	 * a hint to choose the part size, the object may end up of another size.
+	 * With a journal path, the progress of the upload is recorded there so
+	 * that resume() can take it over later.
+	 */
+	QingStorWriter(Context *context, std::string bucket, ObjectInfo object, bool canche,
+				std::string journal = std::string());
+
+	/*
+	 * Take over the upload recorded in the journal: the parts the server
+	 * has, in a row from the first one, are kept, and the offset the data
+	 * has to be written from is returned. Without a journal to take over, a
+	 * new upload is started and 0 is returned.
+	 */
+	int64_t resume();
+
+	~QingStorWriter();
+
+	/*
+	 * Write the object to the spool directory of the context instead: the
+	 * data goes to local disk, close() returns once it is durable there and
+	 * the spool uploader of the context sends it later. Must be called
+	 * before any data is written.
+	 */
+	void spool();
+
+	/*
+	 * Have the parts written by number with writePart(), from any number of
+	 * threads, rather than as one stream of data. The multipart upload is
+	 * initiated right away. Must be called before any data is written.
+	 */
+	void openParts();
+
+	/*
+	 * Send data as the given part, and return once the server has it. May be
+	 * called from several threads at once, the parts of all of them are sent
+	 * at a time as far as max_transfers_per_host allows. A part written
+	 * again replaces the one sent before. The caller keeps the buffer, it is
+	 * not copied.
+	 */
+	void writePart(int32_t partNumber, const char *data, int32_t length);
+
+	/*
+	 * Let a writer elsewhere write parts firstPart to lastPart of the upload
+	 * opened with openParts(), through joinUpload(). Their ETags are handed
+	 * back with addPart() before close().
+	 */
+	UploadToken exportToken(int32_t firstPart, int32_t lastPart);
 
-	~QingStorWriter() {
-		if (mBuffer)
-		{
-			delete mBuffer;
-		}
-	}
-	void transferData(const char *buffer, int32_t length);
+	/*
+	 * Write parts of the upload of another writer, the one the token was
+	 * exported from, with writePart(). close() only waits for the parts and
+	 * cancel() leaves the upload alone, it is up to its owner to complete or
+	 * abort it.
+	 */
+	void joinUpload(const UploadToken &token);
+
+	/*
+	 * ETag of a part written with writePart() or added, empty if none.
+	 */
+	std::string partETag(int32_t partNumber);
+
+	/*
+	 * Record a part written by another writer of the upload, to complete
+	 * it with.
+	 */
+	void addPart(int32_t partNumber, const std::string &etag);
+
+	/*
+	 * Take data to write. With part_buffer_limit set, the part buffers may
+	 * run out; the writer then waits for part_buffer_wait ms, and returns the
+	 * number of bytes it could take, or throws QingStorWouldBlock if none.
+	 */
+	int32_t transferData(const char *buffer, int32_t length);
+
+	/*
+	 * Take over a buffer of the caller and send it as a part of its own,
+	 * without copying it. freeFn(buffer, arg) is called once the writer does
+	 * not need the buffer any more, i.e. when the part is acknowledged, or
+	 * right away if the data had to be copied. If this throws, the buffer is
+	 * not held and freeFn is not called.
+	 */
+	void donateData(char *buffer, int32_t length, void (*freeFn)(void *, void *), void *arg);
+
+	/*
+	 * Upload the whole of a regular file as the object and complete it. The
+	 * parts are planned from the size of the file and upload_concurrency of
+	 * them are sent at a time, each read from fd by the transfer itself.
+	 * The writer is of no use afterwards.
+	 */
+	void putFile(int fd);
 
 	void cancel();
 
@@ -49,26 +162,244 @@ private:
 	std::string mUploadId;
 	std::string mKey;
 	QSCredential mCred;
-	char *mBuffer;
-	int64_t mBuffSize;
+	char *mBuffer;				/* borrowed from the part buffer pool once there is data */
+	int64_t mBuffCapacity;		/* size of mBuffer, may be below mBuffSize */
+	int64_t mBuffSize;			/* size of the part being filled */
 	int64_t mWritePos;
 	int32_t mPartNum;
+	int64_t mOffset;			/* of the next part in the object */
 	bool mCanceled;
 	bool mCache;
 
+	/*
+	 * With upload_concurrency above 1, a full buffer is handed to the upload
+	 * engine of the context and the writer goes on with another buffer. The
+	 * caller only blocks when mConcurrency parts are in flight already, or
+	 * the part buffer pool is exhausted.
+	 */
+	int mConcurrency;
+
+	/*
+	 * With upload_concurrency 1 and the MD5 of the parts to compute, for
+	 * Content-MD5 or the journal, the parts go through the upload engine all
+	 * the same: a part is filled and hashed on a digest thread while the one
+	 * before is on the wire, and is sent once that one is over.
+	 */
+	bool mChained;
+
+	bool mContentMD5;			/* send the MD5 of the parts for the server to check */
+
+	/*
+	 * Parts start at mBasePartSize, and double every PARTS_PER_GROWTH parts
+	 * from part mGrowthStart on, so that a stream of any size fits in the
+	 * part count limit of the service. With an expected size, the base is
+	 * large enough for the whole object and growth only starts past it.
+	 */
+	int64_t mExpectedSize;
+	int64_t mBasePartSize;
+	int32_t mGrowthStart;
+
+	shared_ptr<UploadJournal> mJournal;
+
+	shared_ptr<SpoolFile> mSpool;	/* the data goes there when spooled */
+
+	/*
+	 * With stream_buffer_size set, parts are not held whole: a part goes out
+	 * through a ring of that size while it is written. It starts once the
+	 * ring is full, so an object that fits in the ring still goes with a
+	 * single PUT. Parts are sent with Content-Length: the expected size or
+	 * the part size. Without an expected size, the object may end short of
+	 * the part being streamed, so a copy of that part is kept in mBuffer and
+	 * sent again with its actual length if it does. Only when the pool has
+	 * no memory for the copy does the part go chunked. Not used with a
+	 * journal or Content-MD5, which need the data of a part before it is sent.
+	 */
+	int64_t mStreamBufferSize;
+	shared_ptr<PartStream> mStream;	/* of the part being written, mWritePos bytes in */
+	int64_t mStreamLength;			/* where the part ends, the part size or the expected end */
+	bool mStreamKnown;				/* mStreamLength is sure, the object does not end before */
+	bool mStreamStarted;			/* the part is submitted */
+	bool mStreamCopied;				/* mBuffer holds the mWritePos bytes of the part too */
+
+	/*
+	 * With openParts(), the parts come from writePart() instead. mETags is
+	 * then under mPartMutex as well.
+	 */
+	bool mParted;
+	mutex mPartMutex;
+	condition_variable mPartDone;
+	int mPartsRunning;					/* in writePart() */
+	std::set<int32_t> mFailedParts;		/* not written since they failed */
+	int32_t mFirstPart;					/* range writePart() takes */
+	int32_t mLastPart;
+	bool mJoined;						/* the upload is owned by another writer */
+
+	class InflightPart {
+	public:
+		shared_ptr<PartUpload> part;
+		int64_t offset;
+		char *buffer;					/* a donated buffer, the pooled ones go with the part */
+		void (*freeFn)(void *, void *);
+		void *freeArg;
+	};
+	std::list<InflightPart> mInflightParts;	/* oldest first */
+	std::map<int32_t, std::string> mETags;	/* of the parts sent, by part number */
+
 	void flush();
 
+	/*
+	 * Queue a part on the upload engine. When data is mBuffer, the part
+	 * gives it back to the pool once it is sent. With fd, the part is read
+	 * from the file at mOffset instead.
+	 */
+	void submitPart(char *data, int32_t length, int fd = -1);
+
+	/*
+	 * Send a donated buffer as a part, in the background when parts are
+	 * sent concurrently.
+	 */
+	void submitDonatedPart(char *data, int32_t length, char *buffer,
+				void (*freeFn)(void *, void *), void *arg);
+
+	/*
+	 * Copy data into the part buffer, sending the buffer every time it is
+	 * full. Return how much was copied before the pool ran out, waiting
+	 * waitMs ms for it as acquire() of the pool does.
+	 */
+	int32_t appendData(const char *data, int32_t length, int waitMs);
+
+	/*
+	 * Write data through part streams. Return how much was taken before the
+	 * pool ran out, as appendData() does.
+	 */
+	int32_t streamData(const char *data, int32_t length, int waitMs);
+
+	/*
+	 * Borrow the ring of the next streamed part, once fewer than mConcurrency
+	 * parts are in flight.
+	 */
+	void openStream(int waitMs);
+
+	/*
+	 * Submit the streamed part. With complete set, all of its data is in the
+	 * ring already.
+	 */
+	void startStream(bool complete);
+
+	/*
+	 * The streamed part has all its data, go on with the next one.
+	 */
+	void endStream();
+
+	/*
+	 * The object ended short of the length the streamed part was announced
+	 * with, send the part again from its copy.
+	 */
+	void resendStream();
+
+	/*
+	 * Parts that may be submitted and not over yet.
+	 */
+	int maxInflightParts();
+
+	/*
+	 * Send the mWritePos bytes of the part buffer as a part.
+	 */
+	void sendBuffer();
+
+	/*
+	 * Give back the donated buffer of a part that is over.
+	 */
+	void recycleBuffer(InflightPart &inflight);
+
+	/*
+	 * Borrow a larger mBuffer from the pool, keeping what it holds. A new
+	 * part first waits for one of the parts in flight to be sent if all of
+	 * them are. The first part starts small and doubles up to the part size,
+	 * later ones get a whole part at once. The doubling copies the data of
+	 * the first part once over on average.
+	 */
+	void growBuffer(int waitMs);
+
+	/*
+	 * Choose the part sizes for an object of the expected size, -1 if not
+	 * known.
+	 */
+	void planParts(int64_t expectedSize);
+
+	/*
+	 * Size of the given part.
+	 */
+	int64_t partSize(int32_t partNum);
+
+	/*
+	 * Collect the parts that are sent, oldest first. With wait set, block
+	 * until all of them are. Throws if one of them failed.
+	 */
+	void reapParts(bool wait);
+
+	/*
+	 * Wait for the parts in flight and ignore their outcome, before the
+	 * upload is given up.
+	 */
+	void drainParts();
+
+	/*
+	 * Wait for the parts being written by writePart() to be over.
+	 */
+	void waitForWrittenParts();
+
+	/*
+	 * Complete the upload with the parts written by number, in number order.
+	 */
+	void closeParts();
+
+	/*
+	 * Give mBuffer back to the pool.
+	 */
+	void freeBuffers();
+
 	void initMultipartUpload(std::string host, std::string url, std::string bucket, QSCredential *cred);
 
+	/*
+	 * The multipart upload is only initiated when the first part is sent,
+	 * an object closed before that goes out with putObject().
+	 */
+	void ensureMultipartUpload();
+
+	/*
+	 * Send the whole object with a single PUT Object request.
+	 */
+	void putObject(const char *data, int64_t length);
+
 	bool abortMultipartUpload(std::string host, std::string url, std::string bucket, QSCredential *cred);
 
 	bool uploadMultipart(std::string host, std::string url, std::string bucket, QSCredential * cred,
-				const char *data, int32_t length);
+				const char *data, int32_t length, const char *contentMD5 = NULL);
 
 	bool completeMultipartUpload(std::string host, std::string url, std::string bucket, QSCredential *cred);
 
 	bool extractUploadIDContent(struct json_object *resp_body);
 
+	/*
+	 * MD5 of data sent in the foreground, in hex, and in base64 in
+	 * contentMD5 when it is to be sent. Empty when neither Content-MD5 nor
+	 * the journal need it.
+	 */
+	std::string inlineDigest(const char *data, int64_t length, std::string *contentMD5);
+
+	/*
+	 * Record a part the server acknowledged in the journal, if any.
+	 */
+	void journalPart(int32_t partNumber, int64_t offset, int64_t length,
+				const std::string &md5, const std::string &etag);
+
+	/*
+	 * Get the parts the server holds for mUploadId. Return false if the
+	 * upload is not there any more.
+	 */
+	bool listParts(std::map<int32_t, JournalPart> &parts);
+
 	void doSend(const char *data, int32_t length);
 };
 
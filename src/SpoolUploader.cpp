@@ -0,0 +1,558 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SpoolUploader.h"
+#include "DateTime.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+#include "Function.h"
+#include "Logger.h"
+#include "QingStorWriter.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace QingStor {
+namespace Internal {
+
+static const char *SPOOL_MAGIC = "qingstor-spool 1";
+
+static const char *SPOOL_PREFIX = "spool-";
+
+static const char *META_SUFFIX = ".meta";
+
+static const char *TMP_SUFFIX = ".tmp";
+
+static const char *LOCK_FILE = "lock";
+
+/*
+ * Longest wait between two attempts at an object.
+ */
+static const int MAX_BACKOFF_MS = 30000;
+
+static bool endsWith(const std::string &str, const std::string &suffix)
+{
+	return str.length() >= suffix.length()
+		&& str.compare(str.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+static void writeAll(int fd, const char *data, size_t length, const std::string &path)
+{
+	while (length > 0)
+	{
+		ssize_t n = ::write(fd, data, length);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			THROW(QingStorIOException, "could not write spool file %s: %s", path.c_str(),
+					GetSystemErrorInfo(errno));
+		}
+		data += n;
+		length -= n;
+	}
+}
+
+SpoolFile::~SpoolFile()
+{
+	if (mFd >= 0)
+	{
+		::close(mFd);
+	}
+}
+
+SpoolUploader::SpoolUploader(Context *context, const std::string &dir, int64_t limit, int retries)
+						: mContext(context),
+						  mDir(dir),
+						  mLockFd(-1),
+						  mLimit(limit),
+						  mRetries(retries > 0 ? retries : 1),
+						  mStop(false)
+{
+	memset(&mStatus, 0, sizeof(mStatus));
+	mStatus.limit = limit;
+
+	if (mkdir(mDir.c_str(), 0755) < 0 && errno != EEXIST)
+	{
+		THROW(QingStorIOException, "could not create spool directory %s: %s", mDir.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+
+	/*
+	 * The files without a record are taken for leftovers of a context that
+	 * is gone. They are only that with the directory to ourselves.
+	 */
+	std::string lockPath = mDir + "/" + LOCK_FILE;
+	mLockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (mLockFd < 0)
+	{
+		THROW(QingStorIOException, "could not open spool lock file %s: %s", lockPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	if (flock(mLockFd, LOCK_EX | LOCK_NB) < 0)
+	{
+		int err = errno;
+		::close(mLockFd);
+		mLockFd = -1;
+		if (err == EWOULDBLOCK)
+		{
+			THROW(QingStorIOException, "spool directory %s is used by another context", mDir.c_str());
+		}
+		THROW(QingStorIOException, "could not lock spool directory %s: %s", mDir.c_str(),
+				GetSystemErrorInfo(err));
+	}
+
+	try {
+		mWorker = shared_ptr<BackgroundWorker> (new BackgroundWorker(1));
+		recover();
+	} catch (...)
+	{
+		::close(mLockFd);
+		throw;
+	}
+}
+
+SpoolUploader::~SpoolUploader()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStop = true;
+	}
+	mChanged.notify_all();
+
+	/* the upload being run goes on to its end, the queued ones are left on disk */
+	mWorker.reset();
+
+	/* the next context on the directory may take over what is left */
+	::close(mLockFd);
+}
+
+shared_ptr<SpoolFile> SpoolUploader::create(const std::string &bucket, const std::string &key)
+{
+	std::string path = mDir + "/" + SPOOL_PREFIX + "XXXXXX";
+	std::vector<char> name(path.begin(), path.end());
+	name.push_back('\0');
+
+	int fd = mkstemp(&name[0]);
+	if (fd < 0)
+	{
+		THROW(QingStorIOException, "could not create a spool file in %s: %s", mDir.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+
+	shared_ptr<SpoolFile> file = shared_ptr<SpoolFile> (new SpoolFile);
+	file->mPath = &name[0];
+	file->mBucket = bucket;
+	file->mKey = key;
+	file->mFd = fd;
+	return file;
+}
+
+void SpoolUploader::write(shared_ptr<SpoolFile> file, const char *data, int32_t length)
+{
+	if (file->mFd < 0)
+	{
+		THROW(QingStorIOException, "spool file %s is closed", file->mPath.c_str());
+	}
+
+	{
+		unique_lock<mutex> lock(mMutex);
+		/* only the uploads make room, do not wait when there is none to come */
+		while (mLimit > 0 && mStatus.spooled + length > mLimit && mStatus.pending > 0)
+		{
+			mChanged.wait(lock);
+		}
+		mStatus.spooled += length;
+	}
+
+	try {
+		writeAll(file->mFd, data, length, file->mPath);
+	} catch (...)
+	{
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStatus.spooled -= length;
+		}
+		mChanged.notify_all();
+		throw;
+	}
+	file->mSize += length;
+}
+
+void SpoolUploader::commit(shared_ptr<SpoolFile> file)
+{
+	if (file->mFd < 0)
+	{
+		THROW(QingStorIOException, "spool file %s is closed", file->mPath.c_str());
+	}
+	if (fsync(file->mFd) < 0)
+	{
+		THROW(QingStorIOException, "could not sync spool file %s: %s", file->mPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	::close(file->mFd);
+	file->mFd = -1;
+
+	std::stringstream sstr;
+	sstr<<SPOOL_MAGIC<<"\n";
+	sstr<<"bucket "<<file->mBucket<<"\n";
+	sstr<<"key "<<file->mKey<<"\n";
+	sstr<<"size "<<file->mSize<<"\n";
+	std::string record = sstr.str();
+
+	/* the object is closed once its record is renamed into place */
+	std::string meta = file->mPath + META_SUFFIX;
+	std::string tmp = meta + TMP_SUFFIX;
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		THROW(QingStorIOException, "could not create spool record %s: %s", tmp.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	try {
+		writeAll(fd, record.c_str(), record.length(), tmp);
+		if (fsync(fd) < 0)
+		{
+			THROW(QingStorIOException, "could not sync spool record %s: %s", tmp.c_str(),
+					GetSystemErrorInfo(errno));
+		}
+	} catch (...)
+	{
+		::close(fd);
+		unlink(tmp.c_str());
+		throw;
+	}
+	::close(fd);
+	if (rename(tmp.c_str(), meta.c_str()) < 0)
+	{
+		int eno = errno;
+		unlink(tmp.c_str());
+		THROW(QingStorIOException, "could not rename spool record %s: %s", tmp.c_str(),
+				GetSystemErrorInfo(eno));
+	}
+	syncDirectory();
+
+	Entry entry;
+	entry.path = file->mPath;
+	entry.bucket = file->mBucket;
+	entry.key = file->mKey;
+	entry.size = file->mSize;
+	entry.attempts = 0;
+	queue(entry);
+}
+
+void SpoolUploader::discard(shared_ptr<SpoolFile> file)
+{
+	if (file->mFd >= 0)
+	{
+		::close(file->mFd);
+		file->mFd = -1;
+	}
+	if (unlink(file->mPath.c_str()) < 0 && errno != ENOENT)
+	{
+		LOG(WARNING, "could not remove spool file %s: %s", file->mPath.c_str(), GetSystemErrorInfo(errno));
+	}
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStatus.spooled -= file->mSize;
+	}
+	file->mSize = 0;
+	mChanged.notify_all();
+}
+
+void SpoolUploader::queue(const Entry &entry)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStatus.pending++;
+		mStatus.pendingBytes += entry.size;
+	}
+	mWorker->submit(bind(&SpoolUploader::upload, this, entry));
+}
+
+void SpoolUploader::upload(Entry entry)
+{
+	while (true)
+	{
+		std::string error;
+		int fd = ::open(entry.path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			error = std::string("could not open spool file ") + entry.path + ": "
+					+ GetSystemErrorInfo(errno);
+		}
+		else
+		{
+			try {
+				ObjectInfo object = {entry.key, entry.size};
+				QingStorWriter writer(mContext, entry.bucket, object, true);
+				writer.putFile(fd);
+			} catch (const std::exception & e)
+			{
+				error = e.what();
+			} catch (...)
+			{
+				/* anything the upload throws counts as a failed attempt, or the object stays pending */
+				error = "unknown error";
+			}
+			::close(fd);
+		}
+
+		if (error.empty())
+		{
+			removeFiles(entry.path);
+			{
+				lock_guard<mutex> lock(mMutex);
+				mStatus.pending--;
+				mStatus.pendingBytes -= entry.size;
+				mStatus.spooled -= entry.size;
+				mStatus.uploaded++;
+				mStatus.uploadedBytes += entry.size;
+			}
+			mChanged.notify_all();
+			LOG(DEBUG1, "uploaded spooled object %s/%s (%ld bytes)", entry.bucket.c_str(),
+					entry.key.c_str(), entry.size);
+			return;
+		}
+
+		entry.attempts++;
+		if (entry.attempts >= mRetries)
+		{
+			LOG(LOG_ERROR, "giving up uploading spooled object %s/%s: %s", entry.bucket.c_str(),
+					entry.key.c_str(), error.c_str());
+			{
+				lock_guard<mutex> lock(mMutex);
+				mStatus.pending--;
+				mStatus.pendingBytes -= entry.size;
+				mStatus.failed++;
+				mFailed.push_back(entry);
+				mLastError = error;
+			}
+			mChanged.notify_all();
+			return;
+		}
+
+		int backoff = 1000 << (entry.attempts - 1);
+		backoff = backoff < MAX_BACKOFF_MS ? backoff : MAX_BACKOFF_MS;
+		LOG(WARNING, "could not upload spooled object %s/%s: %s, retrying in %d ms",
+				entry.bucket.c_str(), entry.key.c_str(), error.c_str(), backoff);
+
+		unique_lock<mutex> lock(mMutex);
+		steady_clock::time_point deadline = steady_clock::now() + milliseconds(backoff);
+		while (!mStop && steady_clock::now() < deadline)
+		{
+			mChanged.wait_until(lock, deadline);
+		}
+		if (mStop)
+		{
+			/* still recorded on disk, the next context on the spool takes it over */
+			return;
+		}
+	}
+}
+
+void SpoolUploader::flush(int waitMs)
+{
+	std::list<Entry> failed;
+	{
+		lock_guard<mutex> lock(mMutex);
+		failed.swap(mFailed);
+		mStatus.failed = 0;
+		mLastError.clear();
+	}
+	std::list<Entry>::iterator itr = failed.begin();
+	while (itr != failed.end())
+	{
+		itr->attempts = 0;
+		queue(*itr);
+		itr++;
+	}
+
+	unique_lock<mutex> lock(mMutex);
+	steady_clock::time_point deadline = steady_clock::now() + milliseconds(waitMs > 0 ? waitMs : 0);
+	while (mStatus.pending > 0)
+	{
+		if (waitMs == 0 || (waitMs > 0 && steady_clock::now() >= deadline))
+		{
+			THROW(QingStorWouldBlock, "%d objects of the spool are not uploaded yet", mStatus.pending);
+		}
+		if (waitMs < 0)
+		{
+			mChanged.wait(lock);
+		}
+		else
+		{
+			mChanged.wait_until(lock, deadline);
+		}
+	}
+	if (mStatus.failed > 0)
+	{
+		THROW(QingStorIOException, "%d objects of the spool could not be uploaded: %s",
+				mStatus.failed, mLastError.c_str());
+	}
+}
+
+SpoolStatus SpoolUploader::status()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mStatus;
+}
+
+void SpoolUploader::recover()
+{
+	DIR *dir = opendir(mDir.c_str());
+	if (!dir)
+	{
+		THROW(QingStorIOException, "could not open spool directory %s: %s", mDir.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	std::set<std::string> names;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL)
+	{
+		if (strncmp(ent->d_name, SPOOL_PREFIX, strlen(SPOOL_PREFIX)) == 0)
+		{
+			names.insert(ent->d_name);
+		}
+	}
+	closedir(dir);
+
+	std::set<std::string>::iterator itr = names.begin();
+	while (itr != names.end())
+	{
+		const std::string &name = *itr++;
+		std::string path = mDir + "/" + name;
+
+		if (endsWith(name, TMP_SUFFIX))
+		{
+			unlink(path.c_str());
+			continue;
+		}
+		if (!endsWith(name, META_SUFFIX))
+		{
+			if (names.find(name + META_SUFFIX) == names.end())
+			{
+				/* never closed, its writer is gone */
+				LOG(WARNING, "removing spool file %s of an object that was not closed", path.c_str());
+				unlink(path.c_str());
+			}
+			continue;
+		}
+
+		Entry entry;
+		entry.path = path.substr(0, path.length() - strlen(META_SUFFIX));
+		entry.size = -1;
+		entry.attempts = 0;
+
+		std::string content;
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			char buffer[4096];
+			ssize_t n;
+			while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+			{
+				content.append(buffer, n);
+			}
+			::close(fd);
+		}
+
+		std::istringstream lines(content);
+		std::string line;
+		bool magic = std::getline(lines, line) && line == SPOOL_MAGIC;
+		while (magic && std::getline(lines, line))
+		{
+			if (line.compare(0, 7, "bucket ") == 0)
+			{
+				entry.bucket = line.substr(7);
+			}
+			else if (line.compare(0, 4, "key ") == 0)
+			{
+				entry.key = line.substr(4);
+			}
+			else if (line.compare(0, 5, "size ") == 0)
+			{
+				entry.size = atoll(line.substr(5).c_str());
+			}
+		}
+
+		struct stat st;
+		if (!magic || entry.bucket.empty() || entry.key.empty() || entry.size < 0
+			|| stat(entry.path.c_str(), &st) < 0 || st.st_size != entry.size)
+		{
+			LOG(LOG_ERROR, "spool record %s is damaged, leaving it alone", path.c_str());
+			continue;
+		}
+
+		LOG(INFO, "resuming the upload of spooled object %s/%s", entry.bucket.c_str(), entry.key.c_str());
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStatus.spooled += entry.size;
+		}
+		queue(entry);
+	}
+}
+
+void SpoolUploader::removeFiles(const std::string &path)
+{
+	/* the record first, a data file without one is dropped on recovery */
+	std::string meta = path + META_SUFFIX;
+	if (unlink(meta.c_str()) < 0 && errno != ENOENT)
+	{
+		LOG(WARNING, "could not remove spool record %s: %s", meta.c_str(), GetSystemErrorInfo(errno));
+	}
+	if (unlink(path.c_str()) < 0 && errno != ENOENT)
+	{
+		LOG(WARNING, "could not remove spool file %s: %s", path.c_str(), GetSystemErrorInfo(errno));
+	}
+}
+
+void SpoolUploader::syncDirectory()
+{
+	int fd = ::open(mDir.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LOG(WARNING, "could not open directory %s to sync: %s", mDir.c_str(), GetSystemErrorInfo(errno));
+		return;
+	}
+	if (fsync(fd) < 0)
+	{
+		LOG(WARNING, "could not sync directory %s: %s", mDir.c_str(), GetSystemErrorInfo(errno));
+	}
+	::close(fd);
+}
+
+}
+}
@@ -0,0 +1,191 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_SPOOLUPLOADER_H_
+#define __QINGSTOR_LIBQINGSTOR_SPOOLUPLOADER_H_
+
+#include "BackgroundWorker.h"
+#include "Memory.h"
+#include "Thread.h"
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+
+namespace QingStor {
+namespace Internal {
+
+class Context;
+
+class SpoolStatus {
+public:
+	int64_t limit;			/* most bytes spooled before writers wait, 0 is no cap */
+	int64_t spooled;		/* bytes in the spool, written or waiting to be sent */
+	int32_t pending;		/* objects closed and not in QingStor yet */
+	int64_t pendingBytes;
+	int64_t uploaded;		/* objects sent since the context was created */
+	int64_t uploadedBytes;
+	int32_t failed;			/* objects given up, kept in the spool */
+};
+
+/*
+ * An object being written to the spool.
+ */
+class SpoolFile {
+public:
+	SpoolFile() : mFd(-1), mSize(0) {
+	}
+
+	~SpoolFile();
+
+	const std::string &bucket() {
+		return mBucket;
+	}
+
+	const std::string &key() {
+		return mKey;
+	}
+
+	int64_t size() {
+		return mSize;
+	}
+
+private:
+	friend class SpoolUploader;
+
+	std::string mPath;			/* of the data, the record is mPath + ".meta" */
+	std::string mBucket;
+	std::string mKey;
+	int mFd;
+	int64_t mSize;
+};
+
+/*
+ * Write-back staging of objects on local disk.
+ *
+ * A spooled writer appends its data to a file of the spool directory, and
+ * its close() returns as soon as the data is durable there. A background
+ * thread then uploads the closed files one after the other, each as a file
+ * upload with upload_concurrency parts in flight, and removes them once
+ * they are in QingStor.
+ *
+ * A closed object is recorded by a small file next to its data, written and
+ * renamed into place after the data is fsync'ed. A context started on the
+ * same directory uploads the recorded objects left by an earlier one, and
+ * removes data files that were never closed. A spool directory is locked by
+ * the context using it, another context, of this process or another one,
+ * cannot use it until the first one is destroyed.
+ *
+ * The bytes in the spool are capped by spool_limit: a writer waits for the
+ * uploads to catch up when it would go past it, unless there is nothing
+ * queued to upload, so a single object larger than the cap still goes
+ * through. An object that keeps failing is kept in the spool and counted as
+ * failed until flush() queues it again.
+ */
+class SpoolUploader {
+public:
+	SpoolUploader(Context *context, const std::string &dir, int64_t limit, int retries);
+
+	~SpoolUploader();
+
+	/*
+	 * Start spooling an object.
+	 */
+	shared_ptr<SpoolFile> create(const std::string &bucket, const std::string &key);
+
+	/*
+	 * Append data to a spooled object, waiting for room under the cap.
+	 */
+	void write(shared_ptr<SpoolFile> file, const char *data, int32_t length);
+
+	/*
+	 * Make the object durable in the spool and queue it for upload.
+	 */
+	void commit(shared_ptr<SpoolFile> file);
+
+	/*
+	 * Drop an object that is not closed.
+	 */
+	void discard(shared_ptr<SpoolFile> file);
+
+	/*
+	 * Queue the failed objects again, then wait up to waitMs ms, forever if
+	 * negative, for every closed object to be uploaded. Throws
+	 * QingStorWouldBlock if the time is up first, and QingStorIOException if
+	 * objects failed.
+	 */
+	void flush(int waitMs);
+
+	SpoolStatus status();
+
+private:
+	class Entry {
+	public:
+		std::string path;
+		std::string bucket;
+		std::string key;
+		int64_t size;
+		int attempts;
+	};
+
+	Context *mContext;
+	std::string mDir;
+	int mLockFd;				/* holds the flock of the directory */
+	int64_t mLimit;
+	int mRetries;
+
+	mutex mMutex;
+	condition_variable mChanged;
+	SpoolStatus mStatus;
+	std::list<Entry> mFailed;
+	std::string mLastError;
+	bool mStop;
+
+	/* declared last, the upload being run is over before the rest goes */
+	shared_ptr<BackgroundWorker> mWorker;
+
+	/*
+	 * Queue the objects recorded in the directory, and remove the data of
+	 * the ones never closed.
+	 */
+	void recover();
+
+	void queue(const Entry &entry);
+
+	/*
+	 * Upload a closed object. Run by the worker thread.
+	 */
+	void upload(Entry entry);
+
+	/*
+	 * Remove the data and the record of an object.
+	 */
+	void removeFiles(const std::string &path);
+
+	void syncDirectory();
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_SPOOLUPLOADER_H_ */
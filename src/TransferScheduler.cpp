@@ -0,0 +1,177 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TransferScheduler.h"
+#include "Logger.h"
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * An owner that has not asked for a slot for this long is no longer
+ * considered as waiting, e.g. a reader the application stopped reading
+ * from.
+ */
+static const int64_t WAITER_EXPIRE_MS = 2000;
+
+/*
+ * A demand transfer waiting this long for a slot goes over the cap.
+ */
+static const int64_t DEMAND_WAIT_MS = 5000;
+
+TransferScheduler::TransferScheduler(int maxTransfersPerHost)
+								: mMaxTransfersPerHost(maxTransfersPerHost)
+{
+}
+
+bool TransferScheduler::hasPreferredWaiter(HostState &state, const void *owner, const Waiter &waiter)
+{
+	steady_clock::time_point now = steady_clock::now();
+	int inflight = state.owners[owner];
+	std::map<const void *, Waiter>::iterator itr = state.waiting.begin();
+
+	while (itr != state.waiting.end())
+	{
+		if (ToMilliSeconds(itr->second.last, now) > WAITER_EXPIRE_MS)
+		{
+			state.waiting.erase(itr++);
+			continue;
+		}
+		if (itr->first != owner)
+		{
+			const Waiter &other = itr->second;
+			int otherInflight = state.owners[itr->first];
+			if (other.demand != waiter.demand)
+			{
+				if (other.demand)
+				{
+					return true;
+				}
+			}
+			else if (otherInflight < inflight
+					|| (otherInflight == inflight && other.since < waiter.since))
+			{
+				return true;
+			}
+		}
+		itr++;
+	}
+	return false;
+}
+
+bool TransferScheduler::grant(const std::string &host, HostState &state, const void *owner, bool demand)
+{
+	int &inflight = state.owners[owner];
+
+	if (mMaxTransfersPerHost > 0)
+	{
+		steady_clock::time_point now = steady_clock::now();
+		Waiter waiter;
+		waiter.since = now;
+		waiter.demand = demand;
+		std::map<const void *, Waiter>::iterator itr = state.waiting.find(owner);
+		if (itr != state.waiting.end() && itr->second.demand == demand)
+		{
+			waiter.since = itr->second.since;
+		}
+		waiter.last = now;
+
+		if (state.inflight >= mMaxTransfersPerHost || hasPreferredWaiter(state, owner, waiter))
+		{
+			if (!demand || ToMilliSeconds(waiter.since, now) < DEMAND_WAIT_MS)
+			{
+				state.waiting[owner] = waiter;
+				return false;
+			}
+			LOG(INFO, "a transfer to %s waited %d ms for a slot, letting it over max_transfers_per_host",
+					host.c_str(), static_cast<int>(ToMilliSeconds(waiter.since, now)));
+		}
+	}
+
+	inflight++;
+	state.inflight++;
+	state.waiting.erase(owner);
+	return true;
+}
+
+bool TransferScheduler::acquire(const std::string &host, const void *owner, bool demand)
+{
+	lock_guard<mutex> lock(mMutex);
+	return grant(host, mHosts[host], owner, demand);
+}
+
+void TransferScheduler::acquireDemand(const std::string &host, const void *owner)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	/* wake up now and then to stay listed as waiting */
+	while (!grant(host, mHosts[host], owner, true))
+	{
+		mReleased.wait_until(lock, steady_clock::now() + milliseconds(WAITER_EXPIRE_MS / 2));
+	}
+}
+
+void TransferScheduler::release(const std::string &host, const void *owner)
+{
+	lock_guard<mutex> lock(mMutex);
+	std::map<std::string, HostState>::iterator hitr = mHosts.find(host);
+	if (hitr == mHosts.end())
+	{
+		return;
+	}
+
+	std::map<const void *, int>::iterator oitr = hitr->second.owners.find(owner);
+	if (oitr != hitr->second.owners.end() && oitr->second > 0)
+	{
+		oitr->second--;
+		hitr->second.inflight--;
+		mReleased.notify_all();
+	}
+}
+
+void TransferScheduler::unregister(const std::string &host, const void *owner)
+{
+	lock_guard<mutex> lock(mMutex);
+	std::map<std::string, HostState>::iterator hitr = mHosts.find(host);
+	if (hitr == mHosts.end())
+	{
+		return;
+	}
+
+	HostState &state = hitr->second;
+	std::map<const void *, int>::iterator oitr = state.owners.find(owner);
+	if (oitr != state.owners.end())
+	{
+		state.inflight -= oitr->second;
+		state.owners.erase(oitr);
+		mReleased.notify_all();
+	}
+	state.waiting.erase(owner);
+
+	if (state.owners.empty())
+	{
+		mHosts.erase(hitr);
+	}
+}
+
+}
+}
@@ -0,0 +1,119 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_TRANSFERSCHEDULER_H_
+#define __QINGSTOR_LIBQINGSTOR_TRANSFERSCHEDULER_H_
+
+#include "DateTime.h"
+#include "Thread.h"
+
+#include <map>
+#include <string>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * Hands out transfer slots to the readers and writers of a Context, so that
+ * all of them together keep at most maxTransfersPerHost transfers in flight
+ * to a host.
+ *
+ * A transfer the owner is blocked on (a demand transfer, e.g. the range a
+ * reader returns data from next, or the part a writer sends) goes ahead of
+ * the transfers that run ahead (prefetching ranges, concurrent parts): those
+ * are not granted while an owner waits for a demand slot on the host. Within
+ * each kind, a free slot goes to the waiting owner with the fewest transfers
+ * in flight, then to the one that has waited longest.
+ *
+ * Slots are given back as transfers end, whether the owner is blocked or not,
+ * so owners waiting for one another cannot deadlock. An owner that holds
+ * slots without moving its transfers on (a reader the application stopped
+ * reading from) could still starve the others, so a demand transfer that
+ * waited DEMAND_WAIT_MS for a slot is let through over the cap.
+ */
+class TransferScheduler {
+public:
+	/*
+	 * maxTransfersPerHost of 0 means no cap.
+	 */
+	TransferScheduler(int maxTransfersPerHost);
+
+	/*
+	 * Ask for a slot on host for owner. Returns false if the transfer should
+	 * wait, the owner then asks again later. A granted slot is given back with
+	 * release().
+	 */
+	bool acquire(const std::string &host, const void *owner, bool demand);
+
+	/*
+	 * Get a slot on host for a demand transfer of owner, blocking until there
+	 * is one. For owners that have nothing else to do meanwhile.
+	 */
+	void acquireDemand(const std::string &host, const void *owner);
+
+	void release(const std::string &host, const void *owner);
+
+	/*
+	 * Forget an owner that is going away, along with the slots it still holds.
+	 */
+	void unregister(const std::string &host, const void *owner);
+
+private:
+	class Waiter {
+	public:
+		steady_clock::time_point since;		/* first refused request */
+		steady_clock::time_point last;		/* last refused request */
+		bool demand;
+	};
+
+	class HostState {
+	public:
+		HostState() : inflight(0) {
+		}
+
+		int inflight;
+		std::map<const void *, int> owners;		/* transfers in flight, per owner */
+		std::map<const void *, Waiter> waiting;
+	};
+
+	mutex mMutex;
+	condition_variable mReleased;
+	std::map<std::string, HostState> mHosts;
+	int mMaxTransfersPerHost;
+
+	/*
+	 * Take a slot on the host for owner if it is its turn, or record it as
+	 * waiting.
+	 */
+	bool grant(const std::string &host, HostState &state, const void *owner, bool demand);
+
+	/*
+	 * Whether another owner waiting on the host should get the next slot
+	 * before owner.
+	 */
+	bool hasPreferredWaiter(HostState &state, const void *owner, const Waiter &waiter);
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_TRANSFERSCHEDULER_H_ */
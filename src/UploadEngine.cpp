@@ -0,0 +1,771 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UploadEngine.h"
+#include "DateTime.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+#include "Function.h"
+#include "Logger.h"
+#include "lib/encode.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <sstream>
+
+namespace QingStor {
+namespace Internal {
+
+/*
+ * Threads computing the MD5 of parts, each does several hundred MB/s.
+ */
+static const int DIGEST_THREADS = 2;
+
+PartUpload::PartUpload(const std::string &host, const std::string &url, const std::string &bucket,
+						const QSCredential &cred, const char *data, int64_t length,
+						int32_t partNumber, const void *owner)
+						: mState(PART_QUEUED),
+						  mHost(host),
+						  mUrl(url),
+						  mBucket(bucket),
+						  mCred(cred),
+						  mOwner(owner),
+						  mData(data),
+						  mLength(length),
+						  mPartNumber(partNumber),
+						  mFd(-1),
+						  mFileOffset(0),
+						  mPaused(false),
+						  mBuffer(NULL),
+						  mCurl(NULL),
+						  mHttpHeaders(NULL),
+						  mNFailures(0),
+						  mDigest(false),
+						  mSendDigest(false)
+{
+}
+
+PartUpload::~PartUpload()
+{
+	releaseBuffer();
+	if (mHttpHeaders)
+	{
+		curl_slist_free_all(mHttpHeaders);
+	}
+}
+
+void PartUpload::releaseBuffer()
+{
+	if (mBuffer)
+	{
+		mBufferPool->release(mBuffer);
+		mBuffer = NULL;
+		mData = NULL;
+	}
+}
+
+size_t PartUpload::ReadCallback(void *ptr, size_t size, size_t nmemb, void *userp)
+{
+	MemoryData *md = (MemoryData *)userp;
+	size_t n2read = size * nmemb < md->sizeleft ? size * nmemb : md->sizeleft;
+
+	memcpy(ptr, md->advance, n2read);
+	md->advance += n2read;
+	md->sizeleft -= n2read;
+	return n2read;
+}
+
+size_t PartUpload::FileReadCallback(void *ptr, size_t size, size_t nmemb, void *userp)
+{
+	PartUpload *part = (PartUpload *)userp;
+	MemoryData *md = &part->mMemoryData;
+	size_t n2read = size * nmemb < md->sizeleft ? size * nmemb : md->sizeleft;
+
+	if (n2read == 0)
+	{
+		return 0;
+	}
+
+	ssize_t n;
+	do {
+		n = pread(part->mFd, ptr, n2read, part->mFileOffset + part->mLength - md->sizeleft);
+	} while (n < 0 && errno == EINTR);
+
+	/* running short of data would send a short body, the file changed under us */
+	if (n <= 0)
+	{
+		LOG(LOG_ERROR, "could not read part %d from file: %s", part->mPartNumber,
+				n < 0 ? GetSystemErrorInfo(errno) : "unexpected end of file");
+		return CURL_READFUNC_ABORT;
+	}
+	md->sizeleft -= n;
+	return n;
+}
+
+size_t PartUpload::StreamReadCallback(void *ptr, size_t size, size_t nmemb, void *userp)
+{
+	PartUpload *part = (PartUpload *)userp;
+	size_t n = part->mStream->read((char *)ptr, size * nmemb);
+
+	if (n > 0)
+	{
+		part->mMemoryData.sizeleft -= n;
+		return n;
+	}
+	if (part->mStream->aborted())
+	{
+		return CURL_READFUNC_ABORT;
+	}
+	if (part->mStream->finished())
+	{
+		/* with a Content-Length, the server would wait for the bytes missing */
+		if (part->mLength >= 0 && part->mMemoryData.sizeleft > 0)
+		{
+			LOG(LOG_ERROR, "stream of part %d ended %ld bytes short of its length", part->mPartNumber,
+					(int64_t)part->mMemoryData.sizeleft);
+			return CURL_READFUNC_ABORT;
+		}
+		return 0;
+	}
+	part->mPaused = true;
+	return CURL_READFUNC_PAUSE;
+}
+
+int PartUpload::SeekCallback(void *userp, curl_off_t offset, int origin)
+{
+	PartUpload *part = (PartUpload *)userp;
+
+	if (part->mStream || origin != SEEK_SET)
+	{
+		return CURL_SEEKFUNC_CANTSEEK;
+	}
+	if (offset < 0 || offset > part->mLength)
+	{
+		return CURL_SEEKFUNC_FAIL;
+	}
+	/* a part read from a file finds its place from sizeleft alone */
+	part->mMemoryData.advance = part->mData ? part->mData + offset : NULL;
+	part->mMemoryData.sizeleft = part->mLength - offset;
+	return CURL_SEEKFUNC_OK;
+}
+
+bool PartUpload::computeDigest(unsigned char md5[16])
+{
+	if (mFd < 0 || mLength == 0)
+	{
+		return md5sum(mLength ? mData : "", mLength, md5);
+	}
+
+	long pageSize = sysconf(_SC_PAGESIZE);
+	int64_t start = mFileOffset - mFileOffset % pageSize;
+	size_t length = mLength + (mFileOffset - start);
+	void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, mFd, start);
+	if (map == MAP_FAILED)
+	{
+		LOG(LOG_ERROR, "could not map part %d of file: %s", mPartNumber, GetSystemErrorInfo(errno));
+		return false;
+	}
+	madvise(map, length, MADV_SEQUENTIAL);
+	bool ok = md5sum((const char *)map + (mFileOffset - start), mLength, md5);
+	munmap(map, length);
+	return ok;
+}
+
+size_t PartUpload::HeaderCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	size_t realsize = size * nmemb;
+	PartUpload *part = (PartUpload *)userp;
+	std::string line((const char *)contents, realsize);
+
+	if (line.length() > 5 && strncasecmp(line.c_str(), "ETag:", 5) == 0)
+	{
+		size_t start = line.find_first_not_of(" \t", 5);
+		size_t end = line.find_last_not_of(" \t\r\n");
+		if (start != std::string::npos && end != std::string::npos && end >= start)
+		{
+			part->mETag = line.substr(start, end - start + 1);
+		}
+	}
+	return realsize;
+}
+
+size_t PartUpload::ResponseCallback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+	size_t realsize = size * nmemb;
+	PartUpload *part = (PartUpload *)userp;
+
+	/* only error messages come back, keep the start of them */
+	if (part->mResponse.length() < 1024)
+	{
+		part->mResponse.append((const char *)contents, realsize);
+	}
+	return realsize;
+}
+
+void PartUpload::prepare(CURL *curl)
+{
+	HeaderContent header;
+	std::stringstream sstr;
+	char *path;
+	char *query;
+
+	mCurl = curl;
+	mPaused = false;
+	mMemoryData.advance = mData;
+	mMemoryData.sizeleft = mLength;
+	mResponse.clear();
+	mETag.clear();
+
+	HeaderContent_Add(&header, HOST, mHost.c_str());
+	qs_parse_url(mUrl.c_str(),
+				NULL /* schema */,
+				NULL /* host */,
+				&path,
+				&query,
+				NULL /* fullurl */);
+	if (query)
+	{
+		sstr<<"/"<<mBucket<<path<<"?"<<query;
+	}
+	else
+	{
+		sstr<<"/"<<mBucket<<path;
+	}
+	delete [] path;
+	delete [] query;
+	Signature(&header, sstr.str().c_str(), &mCred, QSRT_UPLOAD_MP, mLength >= 0 ? &mMemoryData : NULL,
+			mSendDigest && !mContentMD5.empty() ? mContentMD5.c_str() : NULL);
+
+	if (mHttpHeaders)
+	{
+		curl_slist_free_all(mHttpHeaders);
+	}
+	mHttpHeaders = HeaderContent_GetList(&header);
+
+	curl_easy_setopt(curl, CURLOPT_URL, mUrl.c_str());
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, mHttpHeaders);
+	curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+	if (mStream)
+	{
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, PartUpload::StreamReadCallback);
+		curl_easy_setopt(curl, CURLOPT_READDATA, (void *)this);
+	}
+	else if (mFd >= 0)
+	{
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, PartUpload::FileReadCallback);
+		curl_easy_setopt(curl, CURLOPT_READDATA, (void *)this);
+	}
+	else
+	{
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, PartUpload::ReadCallback);
+		curl_easy_setopt(curl, CURLOPT_READDATA, (void *)&mMemoryData);
+	}
+	curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, PartUpload::SeekCallback);
+	curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)this);
+	curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)mLength);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, PartUpload::HeaderCallback);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)this);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, PartUpload::ResponseCallback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)this);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)this);
+}
+
+bool PartUpload::etagMatches()
+{
+	if (!mSendDigest || mMD5.empty())
+	{
+		return true;
+	}
+
+	std::string etag = mETag;
+	if (etag.length() >= 2 && etag[0] == '"' && etag[etag.length() - 1] == '"')
+	{
+		etag = etag.substr(1, etag.length() - 2);
+	}
+
+	/* the ETag of a part is not bound to be its MD5, only check one that looks so */
+	if (etag.length() != 32 || etag.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+	{
+		return true;
+	}
+	return strcasecmp(etag.c_str(), mMD5.c_str()) == 0;
+}
+
+UploadEngine::UploadEngine(shared_ptr<ConnectionPool> pool, shared_ptr<TransferScheduler> scheduler,
+						int retries)
+						: mPool(pool),
+						  mScheduler(scheduler),
+						  mRetries(retries),
+						  mStop(false)
+{
+	memset(&mStats, 0, sizeof(mStats));
+	mDigestWorker = shared_ptr<BackgroundWorker> (new BackgroundWorker(DIGEST_THREADS));
+
+	mCurlMHandle = curl_multi_init();
+	if (NULL == mCurlMHandle)
+	{
+		THROW(QingStorException, "could not create CURL multi-handle");
+	}
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (mPool->http2())
+	{
+		curl_multi_setopt(mCurlMHandle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	}
+#endif
+}
+
+UploadEngine::~UploadEngine()
+{
+	/* no digest thread may hand a part over past this point */
+	mDigestWorker.reset();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStop = true;
+	}
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_wakeup(mCurlMHandle);
+#endif
+	if (mThread)
+	{
+		mThread->join();
+	}
+	while (!mIdleHandles.empty())
+	{
+		curl_easy_cleanup(mIdleHandles.front());
+		mIdleHandles.pop_front();
+	}
+	curl_multi_cleanup(mCurlMHandle);
+}
+
+void UploadEngine::submit(shared_ptr<PartUpload> part)
+{
+	if (part->mDigest && part->mMD5.empty())
+	{
+		{
+			lock_guard<mutex> lock(mMutex);
+			if (mStop)
+			{
+				THROW(QingStorException, "upload engine is shutting down");
+			}
+			part->mState = PART_QUEUED;
+		}
+		if (!mDigestWorker->submit(bind(&UploadEngine::digest, this, part)))
+		{
+			THROW(QingStorException, "upload engine is shutting down");
+		}
+		return;
+	}
+
+	enqueue(part);
+}
+
+void UploadEngine::digest(shared_ptr<PartUpload> part)
+{
+	unsigned char md5[16];
+	char hex[33];
+
+	steady_clock::time_point start = steady_clock::now();
+	if (!part->computeDigest(md5))
+	{
+		part->mError = "could not compute the MD5 of the part";
+		finish(part, PART_FAILED);
+		return;
+	}
+	HexEncode(md5, 16, hex);
+	part->mMD5 = hex;
+	char *base64 = Base64Encode((const char *)md5, 16);
+	part->mContentMD5 = base64;
+	free(base64);
+	int64_t micros = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStats.digests++;
+		mStats.digestBytes += part->mLength;
+		mStats.digestMicros += micros;
+	}
+
+	try {
+		enqueue(part);
+	} catch (const QingStorException & e)
+	{
+		part->mError = e.what();
+		finish(part, PART_FAILED);
+	}
+}
+
+void UploadEngine::enqueue(shared_ptr<PartUpload> part)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		if (mStop)
+		{
+			THROW(QingStorException, "upload engine is shutting down");
+		}
+		if (!mThread)
+		{
+			shared_ptr<thread> t = shared_ptr<thread> (new thread);
+			CREATE_THREAD(*t, bind(&UploadEngine::run, this));
+			mThread = t;
+		}
+		part->mState = PART_QUEUED;
+		mSubmitted.push_back(part);
+	}
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_wakeup(mCurlMHandle);
+#endif
+}
+
+void UploadEngine::wait(shared_ptr<PartUpload> part)
+{
+	unique_lock<mutex> lock(mMutex);
+	while (part->mState != PART_DONE && part->mState != PART_FAILED)
+	{
+		mFinished.wait(lock);
+	}
+}
+
+bool UploadEngine::finished(shared_ptr<PartUpload> part)
+{
+	lock_guard<mutex> lock(mMutex);
+	return part->mState == PART_DONE || part->mState == PART_FAILED;
+}
+
+void UploadEngine::wakeup()
+{
+#if LIBCURL_VERSION_NUM >= 0x074400
+	curl_multi_wakeup(mCurlMHandle);
+#endif
+}
+
+void UploadEngine::addInlineDigest(int64_t bytes, int64_t micros)
+{
+	lock_guard<mutex> lock(mMutex);
+	mStats.digests++;
+	mStats.digestBytes += bytes;
+	mStats.inlineDigestMicros += micros;
+}
+
+UploadStats UploadEngine::stats()
+{
+	lock_guard<mutex> lock(mMutex);
+	return mStats;
+}
+
+bool UploadEngine::hasRunningPart(const void *owner)
+{
+	std::list<shared_ptr<PartUpload> >::iterator itr = mRunning.begin();
+	while (itr != mRunning.end())
+	{
+		if ((*itr)->mOwner == owner)
+		{
+			return true;
+		}
+		itr++;
+	}
+	return false;
+}
+
+void UploadEngine::finish(shared_ptr<PartUpload> part, PartState state)
+{
+	part->releaseBuffer();
+	if (part->mStream)
+	{
+		/* a writer still filling the stream of a failed part gives up */
+		part->mStream->abort();
+		part->mStream.reset();
+	}
+	{
+		lock_guard<mutex> lock(mMutex);
+		part->mState = state;
+		mStats.parts += state == PART_DONE ? 1 : 0;
+		mStats.failures += state == PART_FAILED ? 1 : 0;
+	}
+	mFinished.notify_all();
+}
+
+void UploadEngine::launch()
+{
+	steady_clock::time_point now = steady_clock::now();
+	std::list<shared_ptr<PartUpload> >::iterator itr = mQueued.begin();
+	while (itr != mQueued.end())
+	{
+		shared_ptr<PartUpload> part = *itr;
+
+		if (part->mRetryAt > now)
+		{
+			itr++;
+			continue;
+		}
+		if (part->mAfter)
+		{
+			if (!finished(part->mAfter))
+			{
+				itr++;
+				continue;
+			}
+			part->mAfter.reset();
+		}
+
+		/* the writer waits for its first part, the others run ahead */
+		if (!mScheduler->acquire(part->mHost, part->mOwner, !hasRunningPart(part->mOwner)))
+		{
+			itr++;
+			continue;
+		}
+		itr = mQueued.erase(itr);
+
+		CURL *curl = NULL;
+		try {
+			if (!mIdleHandles.empty())
+			{
+				curl = mIdleHandles.front();
+				mIdleHandles.pop_front();
+				mPool->reset(curl);
+			}
+			else
+			{
+				curl = mPool->create();
+			}
+			part->prepare(curl);
+		} catch (const QingStorException & e)
+		{
+			mScheduler->release(part->mHost, part->mOwner);
+			if (curl)
+			{
+				curl_easy_cleanup(curl);
+			}
+			part->mCurl = NULL;
+			part->mError = e.what();
+			finish(part, PART_FAILED);
+			continue;
+		}
+
+		{
+			lock_guard<mutex> lock(mMutex);
+			part->mState = PART_RUNNING;
+		}
+		mRunning.push_back(part);
+		curl_multi_add_handle(mCurlMHandle, curl);
+
+		LOG(DEBUG1, "starting upload of part %d to %s (len %ld)", part->mPartNumber,
+				part->mUrl.c_str(), part->mLength);
+	}
+}
+
+void UploadEngine::reap()
+{
+	CURLMsg *m;
+	int msgq = 0;
+
+	while ((m = curl_multi_info_read(mCurlMHandle, &msgq)))
+	{
+		if (m->msg != CURLMSG_DONE)
+		{
+			continue;
+		}
+
+		CURL *curl = m->easy_handle;
+		CURLcode res = m->data.result;
+		PartUpload *p = NULL;
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&p);
+
+		shared_ptr<PartUpload> part;
+		std::list<shared_ptr<PartUpload> >::iterator itr = mRunning.begin();
+		while (itr != mRunning.end())
+		{
+			if (itr->get() == p)
+			{
+				part = *itr;
+				mRunning.erase(itr);
+				break;
+			}
+			itr++;
+		}
+		if (!part)
+		{
+			LOG(LOG_ERROR, "got CURL result code for a part that's not running");
+			curl_multi_remove_handle(mCurlMHandle, curl);
+			curl_easy_cleanup(curl);
+			continue;
+		}
+
+		long code = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		curl_multi_remove_handle(mCurlMHandle, curl);
+		if (res == CURLE_OK)
+		{
+			mIdleHandles.push_back(curl);
+		}
+		else
+		{
+			curl_easy_cleanup(curl);
+		}
+		mScheduler->release(part->mHost, part->mOwner);
+		part->mCurl = NULL;
+
+		bool mismatch = false;
+		if (res == CURLE_OK && code >= 200 && code < 300)
+		{
+			if (part->etagMatches())
+			{
+				finish(part, PART_DONE);
+				continue;
+			}
+			mismatch = true;
+		}
+
+		std::stringstream sstr;
+		if (mismatch)
+		{
+			sstr<<"upload of part "<<part->mPartNumber<<" got ETag "<<part->mETag
+				<<" while the MD5 of the data is "<<part->mMD5;
+		}
+		else if (res != CURLE_OK)
+		{
+			sstr<<"upload of part "<<part->mPartNumber<<" failed: "<<curl_easy_strerror(res);
+		}
+		else
+		{
+			sstr<<"upload of part "<<part->mPartNumber<<" failed with HTTP "<<code<<": "<<part->mResponse;
+		}
+		part->mError = sstr.str();
+
+		/*
+		 * A client error will not go away by sending the part again, and the
+		 * data of a streamed part is gone once sent.
+		 */
+		bool retry = ++part->mNFailures < mRetries && (res != CURLE_OK || code >= 500 || mismatch)
+					&& !part->mStream;
+		{
+			lock_guard<mutex> lock(mMutex);
+			mStats.etagMismatches += mismatch ? 1 : 0;
+			mStats.retries += retry ? 1 : 0;
+		}
+		if (retry)
+		{
+			int backoff = RetryBackoff(part->mNFailures);
+			LOG(WARNING, "%s, retrying in %d ms", part->mError.c_str(), backoff);
+			part->mRetryAt = steady_clock::now() + milliseconds(backoff);
+			mQueued.push_back(part);
+			continue;
+		}
+		if (part->mStream && part->mStream->aborted())
+		{
+			/* given up by its writer, which knows why */
+			LOG(DEBUG1, "%s", part->mError.c_str());
+		}
+		else
+		{
+			LOG(LOG_ERROR, "%s", part->mError.c_str());
+		}
+		finish(part, PART_FAILED);
+	}
+}
+
+void UploadEngine::resumeStreams()
+{
+	std::list<shared_ptr<PartUpload> >::iterator itr = mRunning.begin();
+	while (itr != mRunning.end())
+	{
+		shared_ptr<PartUpload> part = *itr++;
+		if (part->mPaused && part->mStream->readable())
+		{
+			part->mPaused = false;
+			curl_easy_pause(part->mCurl, CURLPAUSE_CONT);
+		}
+	}
+}
+
+void UploadEngine::run()
+{
+	while (true)
+	{
+		{
+			lock_guard<mutex> lock(mMutex);
+			if (mStop)
+			{
+				break;
+			}
+			mQueued.splice(mQueued.end(), mSubmitted);
+		}
+
+		launch();
+		resumeStreams();
+
+		int running = 0;
+		CURLMcode mres = curl_multi_perform(mCurlMHandle, &running);
+		if (mres != CURLM_OK)
+		{
+			LOG(LOG_ERROR, "curl_multi_perform returned error: %s", curl_multi_strerror(mres));
+		}
+		reap();
+
+		/* parts waiting for a slot or for data are looked at again soon */
+		bool paused = false;
+		std::list<shared_ptr<PartUpload> >::iterator pitr = mRunning.begin();
+		while (pitr != mRunning.end() && !paused)
+		{
+			paused = (*pitr++)->mPaused;
+		}
+		int timeout = mQueued.empty() && !paused ? 1000 : 50;
+#if LIBCURL_VERSION_NUM >= 0x074400
+		curl_multi_poll(mCurlMHandle, NULL, 0, timeout, NULL);
+#else
+		curl_multi_wait(mCurlMHandle, NULL, 0, timeout < 100 ? timeout : 100, NULL);
+#endif
+	}
+
+	/* the engine goes away with its context, fail what is left */
+	std::list<shared_ptr<PartUpload> > left;
+	left.splice(left.end(), mQueued);
+	left.splice(left.end(), mRunning);
+	{
+		lock_guard<mutex> lock(mMutex);
+		left.splice(left.end(), mSubmitted);
+	}
+	std::list<shared_ptr<PartUpload> >::iterator itr = left.begin();
+	while (itr != left.end())
+	{
+		shared_ptr<PartUpload> part = *itr;
+		if (part->mCurl)
+		{
+			curl_multi_remove_handle(mCurlMHandle, part->mCurl);
+			curl_easy_cleanup(part->mCurl);
+			mScheduler->release(part->mHost, part->mOwner);
+			part->mCurl = NULL;
+		}
+		part->mError = "upload engine is shutting down";
+		finish(part, PART_FAILED);
+		itr++;
+	}
+}
+
+}
+}
@@ -0,0 +1,347 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_UPLOADENGINE_H_
+#define __QINGSTOR_LIBQINGSTOR_UPLOADENGINE_H_
+
+#include "QingStorCommon.h"
+#include "BackgroundWorker.h"
+#include "ConnectionPool.h"
+#include "PartBufferPool.h"
+#include "PartStream.h"
+#include "TransferScheduler.h"
+#include "DateTime.h"
+#include "Memory.h"
+#include "Thread.h"
+
+#include <curl/curl.h>
+
+#include <list>
+#include <string>
+
+namespace QingStor {
+namespace Internal {
+
+typedef enum {
+	PART_QUEUED,
+	PART_RUNNING,
+	PART_DONE,
+	PART_FAILED
+} PartState;
+
+/*
+ * One part of a multipart upload, sent by the UploadEngine. The data is only
+ * borrowed, it must stay valid until the part is done or failed. A part can
+ * also be read from a file as it is sent, see readFrom(), or from a stream
+ * still being written, see streamFrom().
+ */
+class PartUpload {
+public:
+	PartUpload(const std::string &host, const std::string &url, const std::string &bucket,
+				const QSCredential &cred, const char *data, int64_t length,
+				int32_t partNumber, const void *owner);
+
+	~PartUpload();
+
+	PartState state() {
+		return mState;
+	}
+
+	int32_t partNumber() {
+		return mPartNumber;
+	}
+
+	const char *data() {
+		return mData;
+	}
+
+	int64_t length() {
+		return mLength;
+	}
+
+	/*
+	 * ETag returned by the server for a done part.
+	 */
+	const std::string &etag() {
+		return mETag;
+	}
+
+	/*
+	 * Why a failed part failed.
+	 */
+	const std::string &error() {
+		return mError;
+	}
+
+	/*
+	 * Have the MD5 of the data computed before the part is sent, on a
+	 * thread of the engine. With send set, it goes out as Content-MD5 for
+	 * the server to check, and the ETag returned is checked against it.
+	 */
+	void requestDigest(bool send) {
+		mDigest = true;
+		mSendDigest = send;
+	}
+
+	/*
+	 * MD5 of the data in hex, once the part is sent, if requested.
+	 */
+	const std::string &md5() {
+		return mMD5;
+	}
+
+	/*
+	 * Have the data read from fd at offset by the curl read callback rather
+	 * than from memory, so the part is never staged in a buffer. The file
+	 * must stay open and unchanged until the part is done or failed.
+	 */
+	void readFrom(int fd, int64_t offset) {
+		mFd = fd;
+		mFileOffset = offset;
+	}
+
+	/*
+	 * Have the data read from a stream as it is written. The length given
+	 * to the constructor is sent as Content-Length, a negative one has the
+	 * part sent chunked. A streamed part is not sent again if it fails, its
+	 * data is gone.
+	 */
+	void streamFrom(shared_ptr<PartStream> stream) {
+		mStream = stream;
+	}
+
+	/*
+	 * Hold the part back until part is done or failed. Its digest is still
+	 * computed meanwhile.
+	 */
+	void runAfter(shared_ptr<PartUpload> part) {
+		mAfter = part;
+	}
+
+	/*
+	 * Hand the part a buffer of the pool, given back as soon as the part is
+	 * done or failed rather than when its writer gets to see it.
+	 */
+	void lendBuffer(shared_ptr<PartBufferPool> pool, char *buffer) {
+		mBufferPool = pool;
+		mBuffer = buffer;
+	}
+
+private:
+	friend class UploadEngine;
+
+	PartState mState;
+
+	std::string mHost;
+	std::string mUrl;
+	std::string mBucket;
+	QSCredential mCred;
+	const void *mOwner;			/* who the transfer slots are taken for */
+
+	const char *mData;
+	int64_t mLength;
+	int32_t mPartNumber;
+	MemoryData mMemoryData;		/* what is left to send */
+	int mFd;					/* the data is read from, -1 if in memory */
+	int64_t mFileOffset;		/* of the data in mFd */
+	shared_ptr<PartStream> mStream;	/* the data comes from, if streamed */
+	bool mPaused;				/* waiting for the stream to have data */
+	shared_ptr<PartUpload> mAfter;	/* not launched before it is over */
+	shared_ptr<PartBufferPool> mBufferPool;
+	char *mBuffer;				/* of mBufferPool, holding the data */
+
+	CURL *mCurl;
+	struct curl_slist *mHttpHeaders;
+	std::string mResponse;
+	std::string mETag;
+	std::string mError;
+	int mNFailures;
+	steady_clock::time_point mRetryAt;	/* not sent again before, after a failure */
+
+	bool mDigest;
+	bool mSendDigest;
+	std::string mMD5;			/* hex */
+	std::string mContentMD5;	/* base64, as sent */
+
+	/*
+	 * Sign the request and set up curl to send the data from the start.
+	 */
+	void prepare(CURL *curl);
+
+	void releaseBuffer();
+
+	/*
+	 * MD5 of the data, mapping the range of the file if it is read from one.
+	 */
+	bool computeDigest(unsigned char md5[16]);
+
+	/*
+	 * Whether the ETag the server returned, if it is an MD5, is the one of
+	 * the data.
+	 */
+	bool etagMatches();
+
+	static size_t ReadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+
+	static size_t FileReadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+
+	static size_t StreamReadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+
+	/*
+	 * Take the body back to offset when curl has to send it again, which a
+	 * streamed part cannot do.
+	 */
+	static int SeekCallback(void *userp, curl_off_t offset, int origin);
+
+	static size_t HeaderCallback(void *contents, size_t size, size_t nmemb, void *userp);
+
+	static size_t ResponseCallback(void *contents, size_t size, size_t nmemb, void *userp);
+};
+
+class UploadStats {
+public:
+	int64_t parts;				/* parts sent */
+	int64_t retries;			/* parts sent again after a failure */
+	int64_t failures;			/* parts given up */
+	int64_t digests;			/* parts whose MD5 was computed */
+	int64_t digestBytes;
+	int64_t digestMicros;		/* spent computing MD5s on the engine threads */
+	int64_t inlineDigestMicros;	/* spent computing MD5s by writers, in the way of their data */
+	int64_t etagMismatches;		/* parts whose ETag was not the MD5 of the data */
+};
+
+/*
+ * Sends the parts of the multipart uploads of a Context in the background.
+ *
+ * One thread drives all the parts on a curl multi handle, with handles of the
+ * connection pool, so a writer that has several parts in flight uses several
+ * connections (or streams of one HTTP/2 connection) at once. Every running
+ * part holds a slot of the transfer scheduler: the first part of a writer is
+ * a demand transfer, the others wait for a free slot. A part that fails is
+ * sent again from the start of its data up to retries times, after a backoff
+ * of RetryBackoff() ms, then reported as failed. Its buffer is held until
+ * then, only a part that is done or failed gives it back.
+ *
+ * The MD5 of a part that asks for it is computed by a couple of digest
+ * threads before the part is queued, so the digest of a part overlaps with
+ * the transfer of the parts before it.
+ *
+ * The thread is started by the first submit().
+ */
+class UploadEngine {
+public:
+	UploadEngine(shared_ptr<ConnectionPool> pool, shared_ptr<TransferScheduler> scheduler,
+				int retries);
+
+	~UploadEngine();
+
+	/*
+	 * Queue a part for sending, and return at once.
+	 */
+	void submit(shared_ptr<PartUpload> part);
+
+	/*
+	 * Block until the part is done or failed.
+	 */
+	void wait(shared_ptr<PartUpload> part);
+
+	/*
+	 * Whether the part is done or failed, does not block.
+	 */
+	bool finished(shared_ptr<PartUpload> part);
+
+	/*
+	 * Have the thread look at the streamed parts again, once a writer put
+	 * data in their stream.
+	 */
+	void wakeup();
+
+	/*
+	 * Account for an MD5 a writer computed by itself.
+	 */
+	void addInlineDigest(int64_t bytes, int64_t micros);
+
+	UploadStats stats();
+
+private:
+	shared_ptr<ConnectionPool> mPool;
+	shared_ptr<TransferScheduler> mScheduler;
+	int mRetries;
+
+	mutex mMutex;
+	condition_variable mFinished;
+	std::list<shared_ptr<PartUpload> > mSubmitted;	/* handed over by submit(), not seen by the thread yet */
+	bool mStop;
+
+	shared_ptr<thread> mThread;
+	CURLM *mCurlMHandle;
+
+	shared_ptr<BackgroundWorker> mDigestWorker;
+	UploadStats mStats;		/* under mMutex */
+
+	/* only touched by the thread */
+	std::list<shared_ptr<PartUpload> > mQueued;		/* waiting for a transfer slot */
+	std::list<shared_ptr<PartUpload> > mRunning;
+
+	/*
+	 * Easy handles of the parts that are over, for the next ones. Their
+	 * connections stay in the cache of mCurlMHandle, not with the handles, so
+	 * they are not given back to the connection pool.
+	 */
+	std::list<CURL *> mIdleHandles;
+
+	void run();
+
+	/*
+	 * Hand a part over to the thread.
+	 */
+	void enqueue(shared_ptr<PartUpload> part);
+
+	/*
+	 * Compute the MD5 of a part, then queue it. Run by the digest threads.
+	 */
+	void digest(shared_ptr<PartUpload> part);
+
+	/*
+	 * Start the queued parts the scheduler lets through.
+	 */
+	void launch();
+
+	/*
+	 * Collect the parts whose transfer is over.
+	 */
+	void reap();
+
+	/*
+	 * Resume the paused parts whose stream has data again.
+	 */
+	void resumeStreams();
+
+	void finish(shared_ptr<PartUpload> part, PartState state);
+
+	bool hasRunningPart(const void *owner);
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_UPLOADENGINE_H_ */
@@ -0,0 +1,291 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "UploadJournal.h"
+#include "Exception.h"
+#include "ExceptionInternal.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sstream>
+
+namespace QingStor {
+namespace Internal {
+
+static const char *JOURNAL_MAGIC = "qingstor-upload-journal 1";
+
+UploadJournal::UploadJournal(const std::string &path)
+						: mPath(path),
+						  mFd(-1),
+						  mValidLength(0)
+{
+}
+
+UploadJournal::~UploadJournal()
+{
+	close();
+}
+
+void UploadJournal::close()
+{
+	if (mFd >= 0)
+	{
+		::close(mFd);
+		mFd = -1;
+	}
+}
+
+bool UploadJournal::load()
+{
+	mBucket.clear();
+	mKey.clear();
+	mUploadId.clear();
+	mParts.clear();
+	mValidLength = 0;
+
+	int fd = ::open(mPath.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+		{
+			return false;
+		}
+		THROW(QingStorIOException, "could not open upload journal %s: %s", mPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+
+	std::string content;
+	char buffer[8192];
+	while (true)
+	{
+		ssize_t n = ::read(fd, buffer, sizeof(buffer));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			int eno = errno;
+			::close(fd);
+			THROW(QingStorIOException, "could not read upload journal %s: %s", mPath.c_str(),
+					GetSystemErrorInfo(eno));
+		}
+		if (n == 0)
+		{
+			break;
+		}
+		content.append(buffer, n);
+	}
+	::close(fd);
+
+	size_t pos = 0;
+	int nlines = 0;
+	while (pos < content.length())
+	{
+		size_t end = content.find('\n', pos);
+		if (end == std::string::npos)
+		{
+			/* the last record was cut short, it never made it */
+			LOG(WARNING, "upload journal %s ends with a partial record", mPath.c_str());
+			break;
+		}
+		std::string line = content.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (nlines++ == 0)
+		{
+			if (line != JOURNAL_MAGIC)
+			{
+				THROW(QingStorIOException, "%s is not an upload journal", mPath.c_str());
+			}
+		}
+		else if (line.compare(0, 7, "bucket ") == 0)
+		{
+			mBucket = line.substr(7);
+		}
+		else if (line.compare(0, 4, "key ") == 0)
+		{
+			mKey = line.substr(4);
+		}
+		else if (line.compare(0, 10, "upload_id ") == 0)
+		{
+			mUploadId = line.substr(10);
+		}
+		else if (line.compare(0, 5, "part ") == 0)
+		{
+			JournalPart part;
+			std::istringstream sstr(line.substr(5));
+			sstr>>part.partNumber>>part.offset>>part.size>>part.md5>>part.etag;
+			if (sstr.fail())
+			{
+				THROW(QingStorIOException, "upload journal %s has a bad record \"%s\"",
+						mPath.c_str(), line.c_str());
+			}
+			if (part.etag == "-")
+			{
+				part.etag.clear();
+			}
+			mParts[part.partNumber] = part;
+		}
+		else
+		{
+			THROW(QingStorIOException, "upload journal %s has a bad record \"%s\"",
+					mPath.c_str(), line.c_str());
+		}
+		mValidLength = pos;
+	}
+
+	/* a journal whose header was not written out holds no upload */
+	return !mBucket.empty() && !mKey.empty() && !mUploadId.empty();
+}
+
+void UploadJournal::start(const std::string &bucket, const std::string &key, const std::string &uploadId)
+{
+	close();
+
+	mFd = ::open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (mFd < 0)
+	{
+		THROW(QingStorIOException, "could not create upload journal %s: %s", mPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	syncDirectory();
+	mValidLength = 0;
+
+	mBucket = bucket;
+	mKey = key;
+	mUploadId = uploadId;
+	mParts.clear();
+
+	std::stringstream sstr;
+	sstr<<JOURNAL_MAGIC<<"\n";
+	sstr<<"bucket "<<bucket<<"\n";
+	sstr<<"key "<<key<<"\n";
+	sstr<<"upload_id "<<uploadId<<"\n";
+	append(sstr.str());
+}
+
+void UploadJournal::reopen()
+{
+	close();
+
+	mFd = ::open(mPath.c_str(), O_WRONLY);
+	if (mFd < 0)
+	{
+		THROW(QingStorIOException, "could not open upload journal %s: %s", mPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+
+	/* drop a partial last record, or the next one would be glued to it */
+	if (ftruncate(mFd, mValidLength) < 0 || lseek(mFd, 0, SEEK_END) < 0)
+	{
+		int eno = errno;
+		close();
+		THROW(QingStorIOException, "could not reopen upload journal %s: %s", mPath.c_str(),
+				GetSystemErrorInfo(eno));
+	}
+}
+
+void UploadJournal::addPart(const JournalPart &part)
+{
+	std::stringstream sstr;
+	sstr<<"part "<<part.partNumber<<" "<<part.offset<<" "<<part.size<<" "
+		<<part.md5<<" "<<(part.etag.empty() ? "-" : part.etag)<<"\n";
+	append(sstr.str());
+	mParts[part.partNumber] = part;
+}
+
+void UploadJournal::append(const std::string &record)
+{
+	if (mFd < 0)
+	{
+		THROW(QingStorIOException, "upload journal %s is not open", mPath.c_str());
+	}
+
+	const char *data = record.c_str();
+	size_t left = record.length();
+	while (left > 0)
+	{
+		ssize_t n = ::write(mFd, data, left);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			THROW(QingStorIOException, "could not write upload journal %s: %s", mPath.c_str(),
+					GetSystemErrorInfo(errno));
+		}
+		data += n;
+		left -= n;
+	}
+
+	if (fsync(mFd) < 0)
+	{
+		THROW(QingStorIOException, "could not sync upload journal %s: %s", mPath.c_str(),
+				GetSystemErrorInfo(errno));
+	}
+	mValidLength += record.length();
+}
+
+void UploadJournal::syncDirectory()
+{
+	std::string dir = ".";
+	size_t slash = mPath.rfind('/');
+	if (slash == 0)
+	{
+		dir = "/";
+	}
+	else if (slash != std::string::npos)
+	{
+		dir = mPath.substr(0, slash);
+	}
+
+	int fd = ::open(dir.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		LOG(WARNING, "could not open directory %s to sync: %s", dir.c_str(), GetSystemErrorInfo(errno));
+		return;
+	}
+	if (fsync(fd) < 0)
+	{
+		LOG(WARNING, "could not sync directory %s: %s", dir.c_str(), GetSystemErrorInfo(errno));
+	}
+	::close(fd);
+}
+
+void UploadJournal::remove()
+{
+	close();
+	if (unlink(mPath.c_str()) < 0 && errno != ENOENT)
+	{
+		LOG(WARNING, "could not remove upload journal %s: %s", mPath.c_str(), GetSystemErrorInfo(errno));
+	}
+	mParts.clear();
+}
+
+}
+}
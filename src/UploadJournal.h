@@ -0,0 +1,138 @@
+/********************************************************************
+ * 2017 -
+ * open source under Apache License Version 2.0
+ ********************************************************************/
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __QINGSTOR_LIBQINGSTOR_UPLOADJOURNAL_H_
+#define __QINGSTOR_LIBQINGSTOR_UPLOADJOURNAL_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+namespace QingStor {
+namespace Internal {
+
+class JournalPart {
+public:
+	int32_t partNumber;
+	int64_t offset;			/* of the part in the object */
+	int64_t size;
+	std::string md5;		/* of the part data, in hex */
+	std::string etag;		/* as returned by the server, empty if unknown */
+};
+
+/*
+ * A local file recording the progress of a multipart upload, so that a
+ * writer of another process can take the upload over after a crash.
+ *
+ * The journal is a text file: a header naming the object and the upload
+ * id, then one line per part acknowledged by the server. Every record is
+ * written with a single write() and fsync'ed before the writer goes on, so
+ * the journal never claims a part the server does not have. A record cut
+ * short by a crash is dropped when the journal is loaded, and a part
+ * recorded twice counts with its last record.
+ */
+class UploadJournal {
+public:
+	UploadJournal(const std::string &path);
+
+	~UploadJournal();
+
+	const std::string &path() {
+		return mPath;
+	}
+
+	/*
+	 * Read the journal left by an earlier writer. Return false if there is
+	 * none, i.e. the file is missing or holds no upload. Throws
+	 * QingStorIOException if the file cannot be read or is not a journal.
+	 */
+	bool load();
+
+	const std::string &bucket() {
+		return mBucket;
+	}
+
+	const std::string &key() {
+		return mKey;
+	}
+
+	const std::string &uploadId() {
+		return mUploadId;
+	}
+
+	/*
+	 * The parts recorded by load(), by part number.
+	 */
+	const std::map<int32_t, JournalPart> &parts() {
+		return mParts;
+	}
+
+	/*
+	 * Start the journal of a new upload, replacing what the file held.
+	 */
+	void start(const std::string &bucket, const std::string &key, const std::string &uploadId);
+
+	/*
+	 * Go on with the upload read by load(), records are appended after the
+	 * last complete one.
+	 */
+	void reopen();
+
+	/*
+	 * Record a part the server acknowledged. The record is on disk when
+	 * this returns.
+	 */
+	void addPart(const JournalPart &part);
+
+	/*
+	 * Delete the journal, once the upload is completed or aborted.
+	 */
+	void remove();
+
+private:
+	std::string mPath;
+	int mFd;
+
+	std::string mBucket;
+	std::string mKey;
+	std::string mUploadId;
+	std::map<int32_t, JournalPart> mParts;
+	int64_t mValidLength;		/* bytes of the file up to the last complete record */
+
+	void close();
+
+	/*
+	 * Write the whole string at the end of the journal and fsync it.
+	 */
+	void append(const std::string &record);
+
+	/*
+	 * fsync the directory of the journal, so that a new file survives a crash.
+	 */
+	void syncDirectory();
+};
+
+}
+}
+
+#endif /* __QINGSTOR_LIBQINGSTOR_UPLOADJOURNAL_H_ */
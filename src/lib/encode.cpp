@@ -87,5 +87,47 @@ sha256hmac(const char *str, char out[33], const char *secret)
     return true;
 }
 
+bool
+md5sum(const char *buffer, size_t length, unsigned char out[16])
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int len = 0;
+
+	if (!EVP_Digest(buffer, length, hash, &len, EVP_md5(), NULL) || len != 16)
+	{
+		return false;
+	}
+	memcpy(out, hash, 16);
+
+	return true;
+}
+
+bool
+md5hex(const char *buffer, size_t length, char out[33])
+{
+	unsigned char hash[16];
+
+	if (!md5sum(buffer, length, hash))
+	{
+		return false;
+	}
+	HexEncode(hash, 16, out);
+
+	return true;
+}
+
+void
+HexEncode(const unsigned char *buffer, size_t length, char *out)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < length; i++)
+	{
+		out[i * 2] = digits[buffer[i] >> 4];
+		out[i * 2 + 1] = digits[buffer[i] & 0x0f];
+	}
+	out[length * 2] = '\0';
+}
+
 }
 }
@@ -33,6 +33,15 @@ char *Base64Encode(const char* buffer, size_t length);
 
 bool sha256hmac(const char *str, char out[65], const char *secret);
 
+/* MD5 of the buffer */
+bool md5sum(const char *buffer, size_t length, unsigned char out[16]);
+
+/* MD5 of the buffer as 32 lower case hex digits, NUL terminated */
+bool md5hex(const char *buffer, size_t length, char out[33]);
+
+/* lower case hex digits of the bytes, NUL terminated */
+void HexEncode(const unsigned char *buffer, size_t length, char *out);
+
 }
 }
 #endif  /* _LIB_ENCODE_FUNCTIONS_ */
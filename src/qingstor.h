@@ -40,6 +40,9 @@ typedef struct QingStorContextInternalWrapper *qingstorContext;
 struct QingStorObjectInternalWrapper;
 typedef struct QingStorObjectInternalWrapper *qingstorObject;
 
+struct QingStorCloseHandleInternalWrapper;
+typedef struct QingStorCloseHandleInternalWrapper *qingstorCloseHandle;
+
 /**
  * qingstorBucketInfo - Information about a QingStor bucket.
  */
@@ -82,6 +85,71 @@ typedef struct
 	char *etag;
 } qingstorHeadObjectResult;
 
+/*
+ * qingstorRange - Bytes of an object, length of them from offset
+ */
+typedef struct
+{
+	int64_t offset;
+	int64_t length;
+} qingstorRange;
+
+/*
+ * qingstorConnectionPoolStats - Reuse counters of the keep-alive connection pool of a context
+ */
+typedef struct
+{
+	int64_t hits;
+	int64_t misses;
+	int64_t discards;
+	int32_t idle;
+} qingstorConnectionPoolStats;
+
+/*
+ * qingstorPartBufferPoolStats - Occupancy of the part buffers shared by the writers of a context
+ */
+typedef struct
+{
+	int64_t limit;
+	int64_t used;
+	int64_t idle;
+	int64_t peak;
+	int32_t buffers;
+	int64_t allocations;
+	int64_t reuses;
+	int64_t waits;
+	int64_t rejections;
+} qingstorPartBufferPoolStats;
+
+/*
+ * qingstorUploadStats - Counters of the parts sent by the writers of a context
+ */
+typedef struct
+{
+	int64_t parts;
+	int64_t retries;
+	int64_t failures;
+	int64_t digests;
+	int64_t digestBytes;
+	int64_t digestMicros;
+	int64_t inlineDigestMicros;
+	int64_t etagMismatches;
+} qingstorUploadStats;
+
+/*
+ * qingstorSpoolStatus - Objects staged in the spool directory of a context
+ */
+typedef struct
+{
+	int64_t limit;
+	int64_t spooled;
+	int32_t pending;
+	int64_t pendingBytes;
+	int64_t uploaded;
+	int64_t uploadedBytes;
+	int32_t failed;
+} qingstorSpoolStatus;
+
 /**
  * Return error information of last failed operation.
  *
@@ -179,6 +247,116 @@ qingstorObject qingstorGetObject(qingstorContext context, const char *bucket,
 qingstorObject qingstorPutObject(qingstorContext context, const char *bucket,
 									const char *key, bool cache = true);
 
+/**
+ * qingstorPutObjectWithSize - create a new object for write, of a size
+ * 								known ahead
+ *
+ * As qingstorPutObject, with the size of the object to choose the part size
+ * from.
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @param cache                 if cache is true, will be cached first;
+ * 								otherwise, will be written immediately
+ * @param expected_size			The size the object is expected to have, or -1 if unknown.
+ * 								It is a hint only, used to choose the part size.
+ * @return						An object handler if a new object created successfully;
+ * 								otherwise NULL.
+ */
+qingstorObject qingstorPutObjectWithSize(qingstorContext context, const char *bucket,
+									const char *key, bool cache, int64_t expected_size);
+
+/**
+ * qingstorResumePutObject - create a new object for write, or go on with
+ * 								an upload interrupted before
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @param journal				Path of a local file recording the progress of the
+ * 								upload. If it holds an upload of the object, the parts
+ * 								the server has are kept; otherwise a new upload is
+ * 								started and recorded there. The file is removed once the
+ * 								object is closed or canceled.
+ * @param offset					Set to the offset in the object the data has to be
+ * 								written from, 0 for a new upload.
+ * @return						An object handler on success; otherwise NULL.
+ */
+qingstorObject qingstorResumePutObject(qingstorContext context, const char *bucket,
+									const char *key, const char *journal, int64_t *offset);
+
+/**
+ * qingstorPutObjectFromFile - upload a local file as an object
+ *
+ * The parts are planned from the size of the file and upload_concurrency
+ * of them are sent at a time. Each part is read from the file as it is
+ * sent, nothing is copied into memory. The file must not change until the
+ * call returns.
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @param fd						A descriptor of a regular file open for reading, read
+ * 								from offset 0 to its end. It is left open.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorPutObjectFromFile(qingstorContext context, const char *bucket,
+									const char *key, int fd);
+
+/**
+ * qingstorPutObjectParts - create a new object whose parts are written by number
+ *
+ * The multipart upload is initiated at once. The parts are then written
+ * with qingstorWritePart, from as many threads as needed, and
+ * qingstorCloseObject completes the object from the parts written, in
+ * part number order. qingstorWrite cannot be used on such an object.
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @return						An object handler on success; otherwise NULL.
+ */
+qingstorObject qingstorPutObjectParts(qingstorContext context, const char *bucket,
+									const char *key);
+
+/**
+ * qingstorPutObjectSpooled - create a new object for write, staged on local disk
+ *
+ * The data written goes to a file of the spool_dir of the context, and
+ * qingstorCloseObject returns as soon as it is durable there. A background
+ * thread uploads the closed objects in the order they were closed, see
+ * qingstorFlushSpool to wait for them to be in QingStor. Objects closed but
+ * not uploaded when the context is destroyed are uploaded by the next
+ * context started on the same spool_dir.
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @return						An object handler on success; otherwise NULL, with errno
+ * 								EINVAL if no spool_dir is configured.
+ */
+qingstorObject qingstorPutObjectSpooled(qingstorContext context, const char *bucket,
+									const char *key);
+
+/**
+ * qingstorFlushSpool - wait for the spooled objects to be in QingStor
+ *
+ * Objects whose upload was given up are tried again first.
+ *
+ * @param timeout_ms				How long to wait in ms, -1 to wait until done.
+ * @return						Return 0 once every object closed so far is uploaded;
+ * 								otherwise -1, with errno EAGAIN if the time ran out first
+ * 								or EIO if some objects could not be uploaded.
+ */
+int qingstorFlushSpool(qingstorContext context, int timeout_ms);
+
+/**
+ * qingstorGetSpoolStatus - Get the state of the spool of a context
+ *
+ * @param stats					Filled with the configured cap (limit, 0 if none), the bytes
+ * 								in the spool (spooled), the objects closed and not uploaded
+ * 								yet and their size (pending), the objects uploaded so far,
+ * 								and the objects given up and kept in the spool (failed).
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorGetSpoolStatus(qingstorContext context, qingstorSpoolStatus *stats);
+
 /**
  * @param bucket					The name of the targeted bucket.
  * @param key					The key of the targeted object.
@@ -208,6 +386,35 @@ int qingstorCancelObject(qingstorContext context, qingstorObject object);
  */
 int qingstorCloseObject(qingstorContext context, qingstorObject object);
 
+/**
+ * qingstorCloseObjectAsync - close a object created for write in the background
+ *
+ * The object is handed over to the context and closed as
+ * qingstorCloseObject does, sending the last part and completing the
+ * upload with the same retries, on one of close_concurrency threads, so
+ * that the closes of many objects overlap. The object must not be used
+ * any more once this returns. Every handle returned must be waited for
+ * with qingstorWaitClose, before the context is destroyed.
+ *
+ * @param object					The targeted object to be close, opened for write.
+ * @return						A handle to wait for the close with; otherwise NULL,
+ * 								and the object is left to the caller.
+ */
+qingstorCloseHandle qingstorCloseObjectAsync(qingstorContext context, qingstorObject object);
+
+/**
+ * qingstorWaitClose - wait for a close started by qingstorCloseObjectAsync
+ *
+ * @param handle					The handle returned by qingstorCloseObjectAsync.
+ * @param timeout_ms				How long to wait in ms, 0 not to wait, -1 to wait
+ * 								until the close is over.
+ * @return						Return 0 once the object is closed, -1 on error with errno
+ * 								set as qingstorCloseObject does. The handle is freed then,
+ * 								unless errno is EAGAIN: the close is still going on
+ * 								after timeout_ms, and the handle is to be waited for again.
+ */
+int qingstorWaitClose(qingstorContext context, qingstorCloseHandle handle, int timeout_ms);
+
 /**
  * qingstorDeleteObject - delete a object
  *
@@ -230,6 +437,97 @@ int qingstorDeleteObject(qingstorContext context, const char *bucket,
  */
 int32_t qingstorRead(qingstorContext context, qingstorObject object, void *buffer, int32_t length);
 
+/**
+ * qingstorReadBorrow - Read data from a open object without copying it
+ *
+ * data is pointed at the next bytes of the object, in the buffer they were
+ * received into. They stay valid until qingstorReadRelease, or
+ * qingstorRead, is called on the object. Calling qingstorReadBorrow again
+ * before that returns the same bytes.
+ *
+ * @param object					The targeted object gain by calling qingstorGetObject.
+ * @param data					Set to the bytes read.
+ * @param length					Set to how many bytes data holds, 0 on end-of-file.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorReadBorrow(qingstorContext context, qingstorObject object, const void **data,
+								int32_t *length);
+
+/**
+ * qingstorReadRelease - Give back the bytes of qingstorReadBorrow
+ *
+ * @param object					The targeted object gain by calling qingstorGetObject.
+ * @param length					How many of the bytes borrowed are used up, at most the
+ * 								length qingstorReadBorrow returned. The others are
+ * 								returned again by the next read.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorReadRelease(qingstorContext context, qingstorObject object, int32_t length);
+
+/**
+ * qingstorPread - Read data from a given offset of a open object
+ *
+ * The bytes are got with a ranged GET of their own, through the connections
+ * of the context. The position of the object for qingstorRead, and the data
+ * it prefetched, are left alone, so reads at scattered offsets do not need
+ * an object each.
+ *
+ * @param object					The targeted object gain by calling qingstorGetObject.
+ * @param offset					Offset in the object to read from. Below 0, the read
+ * 								starts -offset bytes before the end of the object, as
+ * 								a suffix range that does not need its size.
+ * @param buffer					The buffer to copy read bytes into.
+ * @param length					The size of the buffer.
+ * @return						On success, the number of bytes read, fewer than length
+ * 								only at the end of the object.
+ * 								On end-of-file, 0.
+ * 								On error, -1. Errno will be set to the error code.
+ */
+int32_t qingstorPread(qingstorContext context, qingstorObject object, int64_t offset, void *buffer,
+						int32_t length);
+
+/**
+ * qingstorReadv - Read several ranges of an object at once
+ *
+ * The ranges may come in any order and overlap. Ranges less than readv_gap
+ * bytes apart are got with a single GET, the bytes between them dropped,
+ * and GETs longer than chunk_size are split. The GETs run num_connections
+ * at a time, and the data is copied into the buffers as it comes.
+ *
+ * @param bucket					The name of the targeted bucket.
+ * @param key					The key of the targeted object.
+ * @param ranges					The ranges to read, all within the object.
+ * @param buffers				buffers[i] receives the length bytes of ranges[i].
+ * @param n						The number of ranges.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorReadv(qingstorContext context, const char *bucket, const char *key,
+								const qingstorRange *ranges, void **buffers, int n);
+
+/**
+ * qingstorSeek - Go on reading a open object from another offset
+ *
+ * A target in the data already fetched, or a little ahead of it, is reached
+ * without a new request: the prefetched data past it is kept. Seeking
+ * backward, or far ahead, starts the download again from offset. The bytes
+ * of qingstorReadBorrow are released.
+ *
+ * @param object					The targeted object gain by calling qingstorGetObject.
+ * @param offset					Offset in the object, within the range it was opened
+ * 								on or right past its end, for the next read to
+ * 								return end-of-file.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorSeek(qingstorContext context, qingstorObject object, int64_t offset);
+
+/**
+ * qingstorTell - Get the offset in the object of the next byte read
+ *
+ * @param object					The targeted object gain by calling qingstorGetObject.
+ * @return						The offset on success, -1 on error.
+ */
+int64_t qingstorTell(qingstorContext context, qingstorObject object);
+
 /**
  * qingstorWrite - Write data to a open object
  *
@@ -237,9 +535,174 @@ int32_t qingstorRead(qingstorContext context, qingstorObject object, void *buffe
  * @param buffer					The buffer of data to write out.
  * @param length					The size of the buffer.
  * @return						Returns the number of bytes written, -1 on error.
+ * 								With part_buffer_limit configured, fewer bytes than
+ * 								length may be written when the part buffers of the
+ * 								context ran out for part_buffer_wait ms; if none
+ * 								could be, -1 is returned and errno is set to EAGAIN.
  */
 int32_t qingstorWrite(qingstorContext context, qingstorObject object, const void *buffer, int32_t length);
 
+/*
+ * qingstorFreeFunc - Called to give a donated buffer back to its owner
+ */
+typedef void (*qingstorFreeFunc)(void *buffer, void *arg);
+
+/**
+ * qingstorWriteDonate - Write data to a open object without copying it
+ *
+ * The buffer is handed over to the SDK, which sends it as a part of its own
+ * when it is large enough, and calls free_fn(buffer, arg) once the part is
+ * acknowledged. Small buffers, and the bytes needed to complete the data
+ * buffered from earlier writes, are copied into the part buffer as
+ * qingstorWrite does; free_fn is called before returning then. The caller
+ * must not touch the buffer until free_fn is called.
+ *
+ * @param object					The targeted object gain by calling qingstorPutObject.
+ * @param buffer					The buffer of data to write out.
+ * @param length					The size of the buffer.
+ * @param free_fn				Called exactly once when the SDK is done with the buffer.
+ * @param arg					Passed to free_fn.
+ * @return						Returns the number of bytes written, -1 on error. On error
+ * 								the buffer stays with the caller and free_fn is not called.
+ */
+int32_t qingstorWriteDonate(qingstorContext context, qingstorObject object, void *buffer, int32_t length,
+								qingstorFreeFunc free_fn, void *arg);
+
+/**
+ * qingstorWritePart - Write one part of an object opened by qingstorPutObjectParts
+ *
+ * The part is sent from the buffer as it is and the call returns once the
+ * server has it. Several threads may write parts of the same object at
+ * once; the parts of all of them are sent at a time, upload_concurrency
+ * does not apply. Together with the other transfers of the context they
+ * are held to max_transfers_per_host, the calls beyond wait for their turn.
+ * Writing a part again replaces it. QingStor wants every part but the last
+ * one to be at least 4MB.
+ *
+ * @param object					The targeted object gain by calling qingstorPutObjectParts.
+ * @param part_number			The number of the part, from 0 to 9999.
+ * @param buffer					The data of the part.
+ * @param length					The size of the part.
+ * @return						Return 0 on success, -1 on error. A part that failed
+ * 								must be written again before the object is closed.
+ */
+int qingstorWritePart(qingstorContext context, qingstorObject object, int32_t part_number,
+								const void *buffer, int32_t length);
+
+/**
+ * qingstorExportUploadToken - Let another process write parts of an object
+ *
+ * The token names the object, its multipart upload and the range of part
+ * numbers the other process may write, as text to be passed around as is.
+ * The other process opens it with qingstorPutObjectFromToken and writes its
+ * parts with qingstorWritePart; their ETags are then handed back to this
+ * object with qingstorAddPart before it is closed.
+ *
+ * @param object					The targeted object gain by calling qingstorPutObjectParts.
+ * @param first_part				The first part number the token allows.
+ * @param last_part				The last part number the token allows.
+ * @param token					Filled with the token, null terminated.
+ * @param size					The size of token.
+ * @return						Return the length of the token on success, -1 on error,
+ * 								with errno ERANGE if token is too small.
+ */
+int32_t qingstorExportUploadToken(qingstorContext context, qingstorObject object,
+								int32_t first_part, int32_t last_part, char *token, int32_t size);
+
+/**
+ * qingstorPutObjectFromToken - open the upload of another process to write parts of it
+ *
+ * Parts in the range of the token are written with qingstorWritePart.
+ * qingstorCloseObject only waits for them, and qingstorCancelObject leaves
+ * the upload as it is: completing or aborting it is up to the process that
+ * exported the token.
+ *
+ * @param token					A token from qingstorExportUploadToken.
+ * @return						An object handler on success; otherwise NULL, with errno
+ * 								EINVAL if token is not a valid token.
+ */
+qingstorObject qingstorPutObjectFromToken(qingstorContext context, const char *token);
+
+/**
+ * qingstorGetPartETag - Get the ETag of a part written with qingstorWritePart
+ *
+ * @param part_number			The number of the part.
+ * @param etag					Filled with the ETag, null terminated.
+ * @param size					The size of etag.
+ * @return						Return 0 on success, -1 on error, with errno ENOENT if
+ * 								the part was not written, ERANGE if etag is too small.
+ */
+int qingstorGetPartETag(qingstorContext context, qingstorObject object, int32_t part_number,
+								char *etag, int32_t size);
+
+/**
+ * qingstorAddPart - Record a part written by another process
+ *
+ * @param object					The object the upload token was exported from.
+ * @param part_number			The number of the part.
+ * @param etag					The ETag of the part, as qingstorGetPartETag gave it.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorAddPart(qingstorContext context, qingstorObject object, int32_t part_number,
+								const char *etag);
+
+/**
+ * qingstorGetConnectionPoolStats - Get the reuse counters of the connection pool
+ *
+ * @param context				The context whose pool is inspected.
+ * @param stats					Filled with the number of requests served by a kept-alive
+ * 								connection (hits), by a new connection (misses), the number
+ * 								of connections closed instead of being kept (discards), and
+ * 								the number of connections currently idle.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorGetConnectionPoolStats(qingstorContext context, qingstorConnectionPoolStats *stats);
+
+/**
+ * qingstorGetPartBufferPoolStats - Get the occupancy of the part buffer pool
+ *
+ * @param context				The context whose pool is inspected.
+ * @param stats					Filled with the configured cap (limit, 0 if none), the bytes
+ * 								lent to writers (used, and its highest value peak), the bytes
+ * 								kept for reuse (idle), the number of buffers lent, and counters
+ * 								of new buffers, reused buffers, requests that waited for
+ * 								memory and requests turned down for lack of it.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorGetPartBufferPoolStats(qingstorContext context, qingstorPartBufferPoolStats *stats);
+
+/**
+ * qingstorGetUploadStats - Get the counters of the parts uploaded
+ *
+ * @param context				The context whose uploads are inspected.
+ * @param stats					Filled with the number of parts sent, sent again and given
+ * 								up, the parts and bytes whose MD5 was computed, the time
+ * 								spent on it by the background threads (digestMicros) and by
+ * 								the writers themselves (inlineDigestMicros), and the parts
+ * 								whose ETag did not match their MD5.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorGetUploadStats(qingstorContext context, qingstorUploadStats *stats);
+
+/**
+ * qingstorPrewarm - Open connections to a bucket ahead of the first request
+ *
+ * The connections are opened in the background, each on a handle of the
+ * connection pool of the context, and kept alive there. A connection stays
+ * with its handle, so the requests sent on a single handle pick them up
+ * first: the head of qingstorGetObject, qingstorPread, and the parts of
+ * writers with upload_concurrency 1. Readers and concurrent uploads open
+ * connections of their own, with the DNS lookup and the TLS session already
+ * warm. The call itself does not wait for the connections.
+ *
+ * @param context				The context to prewarm.
+ * @param bucket					The bucket whose endpoint is connected to.
+ * @param n						The number of connections to open, at most max_idle_connections.
+ * 								If n <= 0, prewarm_connections of the configuration is used.
+ * @return						Return 0 on success, -1 on error.
+ */
+int qingstorPrewarm(qingstorContext context, const char *bucket, int n);
+
 #ifdef __cplusplus
 }
 #endif